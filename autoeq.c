@@ -0,0 +1,395 @@
+#include "autoeq.h"
+#include "sound.h" // SAMPLERATE
+
+#include <stdio.h>  // fopen, fgets, fclose
+#include <stdlib.h> // malloc, calloc, free, strtod
+#include <string.h> // memcpy, strerror
+#include <math.h>   // cos, sin, log, log10, exp, pow, sqrt, fabs
+#include <errno.h>
+
+#define PI 3.14159265358979323846
+#define DB_PER_NEPER (10 / 2.302585092994046) // 10 / ln(10)
+
+// y(x) from the points (xs[i], ys[i]) with increasing xs, linear over log(x) and flat beyond the ends.
+static double interpolate_log(const double *xs, const double *ys, int n, double x) {
+    if(x <= xs[0]) return ys[0];
+    if(x >= xs[n - 1]) return ys[n - 1];
+    int i = 1;
+    while(xs[i] < x) i++;
+    const double t = log(x / xs[i - 1]) / log(xs[i] / xs[i - 1]);
+    return ys[i - 1] + t * (ys[i] - ys[i - 1]);
+}
+
+char *autoeq_load_target(const char *filename, const equalizer *eq, double *target_db) {
+    FILE *file = fopen(filename, "r");
+    if(file == NULL) return strerror(errno);
+
+    int n = 0, capacity = 256;
+    double *freqs = malloc(capacity * sizeof(double));
+    double *levels = malloc(capacity * sizeof(double));
+    char *err = freqs == NULL || levels == NULL ? "Not enough memory for the target" : "";
+
+    char line[256];
+    while(err[0] == '\0' && fgets(line, sizeof(line), file) != NULL) {
+        char *end;
+        const double freq = strtod(line, &end);
+        if(end == line) continue; // header or comment
+        while(*end == ',' || *end == ' ' || *end == '\t') end++;
+        char *level_end;
+        const double level = strtod(end, &level_end);
+        if(level_end == end) continue;
+
+        if(freq <= 0.0 || (n > 0 && freq <= freqs[n - 1])) {
+            err = "Target frequencies must be positive and increasing";
+            break;
+        }
+        if(n == capacity) {
+            // on failure the old arrays are still there to be freed
+            double *grown = realloc(freqs, 2 * capacity * sizeof(double));
+            if(grown != NULL) freqs = grown;
+            grown = grown == NULL ? NULL : realloc(levels, 2 * capacity * sizeof(double));
+            if(grown == NULL) {
+                err = "Not enough memory for the target";
+                break;
+            }
+            levels = grown;
+            capacity *= 2;
+        }
+        freqs[n] = freq;
+        levels[n] = level;
+        n++;
+    }
+    fclose(file);
+
+    if(err[0] == '\0' && n == 0) err = "Target file has no data";
+    if(err[0] == '\0')
+        for(int i = 0; i < eq->nfreq; i++)
+            target_db[i] = interpolate_log(freqs, levels, n, eq->freqs[i]);
+
+    free(freqs);
+    free(levels);
+    return err;
+}
+
+// Everything a fit needs, laid out for the inner loops: the parameters of band b are p[b], its
+// gain in dB, and p[nbands + b], the natural log of its Q factor. Only the gains are fitted when
+// the Q factors are fixed, which makes nparams = nbands.
+typedef struct problem {
+    int nbands, npoints, nparams;
+    double *cos_w, *sin2_w;     // per grid point
+    double *target;             // per grid point
+    double *cos_w0, *sin2_w0;   // per band
+    double *q0;                 // log Q each band is pulled towards
+    double *A2, *alpha2;        // per band, scratch for evaluate()
+    bool fixed_q;
+} problem;
+
+// Residuals r[i] = response - target in dB and, if J is not NULL, their derivatives
+// J[i * nparams + j] = dr[i] / dp[j]. Returns the cost the fit minimises.
+static double evaluate(const problem *pb, const double *p, double *r, double *J) {
+    const int n = pb->nbands;
+    for(int b = 0; b < n; b++) {
+        pb->A2[b] = pow(10.0, p[b] / 20);
+        pb->alpha2[b] = pb->sin2_w0[b] / (4 * exp(2 * p[n + b]));
+    }
+
+    double cost = 0.0;
+    for(int i = 0; i < pb->npoints; i++) {
+        double *row = J == NULL ? NULL : J + (size_t) i * pb->nparams;
+        double response = 0.0;
+        for(int b = 0; b < n; b++) {
+            // |H|^2 = (P + alpha^2 A^2 sin^2 w) / (P + alpha^2 / A^2 sin^2 w), P = (cos w - cos w0)^2,
+            // from the numerator and denominator of the peaking EQ multiplied by e^jw
+            const double A2 = pb->A2[b];
+            const double P = (pb->cos_w[i] - pb->cos_w0[b]) * (pb->cos_w[i] - pb->cos_w0[b]);
+            const double u = pb->alpha2[b] * pb->sin2_w[i];
+            const double boost = u * A2 / (P + u * A2), cut = u / (P * A2 + u);
+            response += DB_PER_NEPER * log((P + u * A2) / (P + u / A2));
+
+            if(row != NULL) {
+                row[b] = 0.5 * (boost + cut);
+                if(!pb->fixed_q) row[n + b] = 2 * DB_PER_NEPER * (cut - boost);
+            }
+        }
+        r[i] = response - pb->target[i];
+        cost += r[i] * r[i];
+    }
+
+    if(!pb->fixed_q)
+        for(int b = 0; b < n; b++)
+            cost += AUTOEQ_Q_WEIGHT * (p[n + b] - pb->q0[b]) * (p[n + b] - pb->q0[b]);
+    return cost;
+}
+
+// Solve a x = b in place for a symmetric positive definite a, by Cholesky decomposition.
+static bool cholesky_solve(double *a, double *b, int n) {
+    for(int j = 0; j < n; j++) {
+        double d = a[j * n + j];
+        for(int k = 0; k < j; k++) d -= a[j * n + k] * a[j * n + k];
+        if(d <= 0.0) return false;
+        d = sqrt(d);
+        a[j * n + j] = d;
+        for(int i = j + 1; i < n; i++) {
+            double s = a[i * n + j];
+            for(int k = 0; k < j; k++) s -= a[i * n + k] * a[j * n + k];
+            a[i * n + j] = s / d;
+        }
+    }
+    for(int i = 0; i < n; i++) {
+        for(int k = 0; k < i; k++) b[i] -= a[i * n + k] * b[k];
+        b[i] /= a[i * n + i];
+    }
+    for(int i = n - 1; i >= 0; i--) {
+        for(int k = i + 1; k < n; k++) b[i] -= a[k * n + i] * b[k];
+        b[i] /= a[i * n + i];
+    }
+    return true;
+}
+
+static int nearest_q_option(double logq) {
+    int best = 0;
+    for(int k = 1; k < 10; k++)
+        if(fabs(log(eq_q_values[k]) - logq) < fabs(log(eq_q_values[best]) - logq)) best = k;
+    return best;
+}
+
+static void clamp_params(const problem *pb, double *p) {
+    const double lo_q = log(eq_q_values[0]), hi_q = log(eq_q_values[9]);
+    for(int b = 0; b < pb->nbands; b++) {
+        p[b] = fmin(fmax(p[b], LOGAIN), HIGAIN);
+        p[pb->nbands + b] = fmin(fmax(p[pb->nbands + b], lo_q), hi_q);
+    }
+}
+
+static double rms(const double *r, int n) {
+    double sum_squares = 0.0;
+    for(int i = 0; i < n; i++) sum_squares += r[i] * r[i];
+    return sqrt(sum_squares / n);
+}
+
+// Copy a solution into an equalizer, with the Q factors snapped to the available options.
+static void store(equalizer *eq, const double *p) {
+    for(int b = 0; b < eq->nfreq; b++) {
+        eq->gain_db[b] = p[b];
+        eq->q_idx[b] = nearest_q_option(p[eq->nfreq + b]);
+    }
+}
+
+// Levenberg-Marquardt iterations from p, which receives the solution. Returns false if stopped by
+// the callback.
+static bool solve(const problem *pb, double *p, equalizer *eq, double *rms_db,
+                  bool (*step_callback)(const equalizer *eq, double rms_db, void *context),
+                  void *context) {
+    const int m = pb->nparams;
+    double *r = malloc(pb->npoints * sizeof(double));
+    double *J = malloc((size_t) pb->npoints * m * sizeof(double));
+    double *normal = malloc((size_t) m * m * sizeof(double));
+    double *a = malloc((size_t) m * m * sizeof(double));
+    double *gradient = malloc(m * sizeof(double));
+    double *step = malloc(m * sizeof(double));
+    double *trial = malloc(2 * pb->nbands * sizeof(double));
+    bool proceed = true, converged = false;
+
+    double lambda = 1e-3;
+    double cost = evaluate(pb, p, r, J);
+
+    for(int iteration = 0; iteration < AUTOEQ_ITERATIONS && proceed && !converged; iteration++) {
+        // normal equations J^T J and J^T r, plus the Q penalty
+        for(int j = 0; j < m; j++) {
+            gradient[j] = 0.0;
+            for(int k = 0; k <= j; k++) normal[j * m + k] = 0.0;
+        }
+        for(int i = 0; i < pb->npoints; i++) {
+            const double *row = J + (size_t) i * m;
+            for(int j = 0; j < m; j++) {
+                gradient[j] += row[j] * r[i];
+                for(int k = 0; k <= j; k++) normal[j * m + k] += row[j] * row[k];
+            }
+        }
+        if(!pb->fixed_q) {
+            for(int b = pb->nbands; b < m; b++) {
+                normal[b * m + b] += AUTOEQ_Q_WEIGHT;
+                gradient[b] += AUTOEQ_Q_WEIGHT * (p[b] - pb->q0[b - pb->nbands]);
+            }
+        }
+
+        // raise the damping until a step lowers the cost
+        bool improved = false;
+        while(!improved && lambda < 1e10) {
+            for(int j = 0; j < m; j++) {
+                for(int k = 0; k <= j; k++) a[j * m + k] = normal[j * m + k];
+                a[j * m + j] *= 1 + lambda;
+                step[j] = -gradient[j];
+            }
+            if(cholesky_solve(a, step, m)) {
+                memcpy(trial, p, 2 * pb->nbands * sizeof(double));
+                for(int j = 0; j < m; j++) trial[j] += step[j];
+                clamp_params(pb, trial);
+                const double trial_cost = evaluate(pb, trial, r, NULL);
+                if(trial_cost < cost) {
+                    improved = true;
+                    converged = cost - trial_cost < AUTOEQ_TOLERANCE * cost;
+                    memcpy(p, trial, m * sizeof(double));
+                    cost = evaluate(pb, p, r, J);
+                    lambda = fmax(lambda / 3, 1e-9);
+                }
+            }
+            if(!improved) lambda *= 4;
+        }
+        if(!improved) break;
+
+        *rms_db = rms(r, pb->npoints);
+        store(eq, p);
+        if(step_callback != NULL) proceed = step_callback(eq, *rms_db, context);
+    }
+
+    evaluate(pb, p, r, NULL);
+    *rms_db = rms(r, pb->npoints);
+
+    free(r);
+    free(J);
+    free(normal);
+    free(a);
+    free(gradient);
+    free(step);
+    free(trial);
+    return proceed;
+}
+
+double autoeq_fit(equalizer *eq, const double *target_db,
+                  bool (*step_callback)(const equalizer *eq, double rms_db, void *context),
+                  void *context) {
+    const int n = eq->nfreq;
+    problem pb = {
+        .nbands = n,
+        .npoints = AUTOEQ_OVERSAMPLING * (n - 1) + 1,
+        .nparams = 2 * n
+    };
+    pb.cos_w = malloc(pb.npoints * sizeof(double));
+    pb.sin2_w = malloc(pb.npoints * sizeof(double));
+    pb.target = malloc(pb.npoints * sizeof(double));
+    pb.cos_w0 = malloc(n * sizeof(double));
+    pb.sin2_w0 = malloc(n * sizeof(double));
+    pb.q0 = malloc(n * sizeof(double));
+    pb.A2 = malloc(n * sizeof(double));
+    pb.alpha2 = malloc(n * sizeof(double));
+    double *p = malloc(pb.nparams * sizeof(double));
+
+    // grid spaced like the bands, AUTOEQ_OVERSAMPLING times denser
+    for(int i = 0; i < pb.npoints; i++) {
+        const double f = eq->freqs[0] * pow(eq->freqs[n - 1] / eq->freqs[0], (double) i / (pb.npoints - 1));
+        const double w = 2 * PI * f / SAMPLERATE;
+        pb.cos_w[i] = cos(w);
+        pb.sin2_w[i] = sin(w) * sin(w);
+        pb.target[i] = interpolate_log(eq->freqs, target_db, n, f);
+    }
+
+    // start from the current Q factors and half the target, since neighbouring bands overlap
+    for(int b = 0; b < n; b++) {
+        const double w0 = 2 * PI * eq->freqs[b] / SAMPLERATE;
+        pb.cos_w0[b] = cos(w0);
+        pb.sin2_w0[b] = sin(w0) * sin(w0);
+        pb.q0[b] = log(eq_q_values[eq->q_idx[b]]);
+        p[b] = target_db[b] / 2;
+        p[n + b] = pb.q0[b];
+    }
+    clamp_params(&pb, p);
+
+    double rms_db = 0.0;
+    if(solve(&pb, p, eq, &rms_db, step_callback, context)) {
+        // snap the Q factors to the options the user interface has, and refit the gains
+        for(int b = 0; b < n; b++) p[n + b] = log(eq_q_values[nearest_q_option(p[n + b])]);
+        pb.fixed_q = true;
+        pb.nparams = n;
+        solve(&pb, p, eq, &rms_db, step_callback, context);
+    }
+    store(eq, p);
+
+    free(pb.cos_w);
+    free(pb.sin2_w);
+    free(pb.target);
+    free(pb.cos_w0);
+    free(pb.sin2_w0);
+    free(pb.q0);
+    free(pb.A2);
+    free(pb.alpha2);
+    free(p);
+    return rms_db;
+}
+
+// Publish every improved solution to the job, stopping if it was cancelled.
+static bool publish(const equalizer *eq, double rms_db, void *context) {
+    autoeq_job *job = context;
+    pthread_mutex_lock(&job->lock);
+    memcpy(job->eq.gain_db, eq->gain_db, eq->nfreq * sizeof(double));
+    memcpy(job->eq.q_idx, eq->q_idx, eq->nfreq * sizeof(uint8_t));
+    job->rms_db = rms_db;
+    job->updated = true;
+    const bool proceed = !job->cancel;
+    pthread_mutex_unlock(&job->lock);
+    return proceed;
+}
+
+static void *job_main(void *arg) {
+    autoeq_job *job = arg;
+
+    // the solver works on its own copy, so that polling never sees a half written solution
+    equalizer work = { 0 };
+    pthread_mutex_lock(&job->lock);
+    eq_init(&work, job->eq.nfreq);
+    memcpy(work.freqs, job->eq.freqs, work.nfreq * sizeof(double));
+    memcpy(work.q_idx, job->eq.q_idx, work.nfreq * sizeof(uint8_t));
+    pthread_mutex_unlock(&job->lock);
+
+    autoeq_fit(&work, job->target_db, publish, job);
+    publish(&work, job->rms_db, job);
+
+    pthread_mutex_lock(&job->lock);
+    job->running = false;
+    pthread_mutex_unlock(&job->lock);
+    eq_delete(&work);
+    return NULL;
+}
+
+void autoeq_job_start(autoeq_job *job, const equalizer *eq, const double *target_db) {
+    const autoeq_job empty = { 0 };
+    *job = empty;
+
+    eq_init(&job->eq, eq->nfreq);
+    memcpy(job->eq.gain_db, eq->gain_db, eq->nfreq * sizeof(double));
+    memcpy(job->eq.q_idx, eq->q_idx, eq->nfreq * sizeof(uint8_t));
+    memcpy(job->eq.freqs, eq->freqs, eq->nfreq * sizeof(double));
+    job->target_db = malloc(eq->nfreq * sizeof(double));
+    memcpy(job->target_db, target_db, eq->nfreq * sizeof(double));
+    job->running = true;
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_create(&job->thread, NULL, job_main, job);
+}
+
+bool autoeq_job_poll(autoeq_job *job, equalizer *eq, double *rms_db) {
+    pthread_mutex_lock(&job->lock);
+    if(job->updated) {
+        memcpy(eq->gain_db, job->eq.gain_db, eq->nfreq * sizeof(double));
+        memcpy(eq->q_idx, job->eq.q_idx, eq->nfreq * sizeof(uint8_t));
+        job->updated = false;
+    }
+    *rms_db = job->rms_db;
+    const bool running = job->running;
+    pthread_mutex_unlock(&job->lock);
+    return running;
+}
+
+void autoeq_job_finish(autoeq_job *job) {
+    pthread_mutex_lock(&job->lock);
+    job->cancel = true;
+    pthread_mutex_unlock(&job->lock);
+
+    pthread_join(job->thread, NULL);
+    pthread_mutex_destroy(&job->lock);
+    eq_delete(&job->eq);
+    free(job->target_db);
+
+    const autoeq_job empty = { 0 };
+    *job = empty;
+}
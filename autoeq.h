@@ -0,0 +1,106 @@
+/** \file autoeq.h
+ *  \defgroup autoeq Auto-EQ module
+ *  \{
+ *  \brief The auto-EQ module fits the gain and Q factor of every band of an equalizer so that its
+ *         overall response matches a target magnitude curve.
+ *
+ *  The fit is a Levenberg-Marquardt least squares solve over the gain and logarithm of the Q
+ *  factor of each band, on a grid AUTOEQ_OVERSAMPLING times denser than the band frequencies. The
+ *  response of a peaking EQ in dB and its derivatives have closed forms derived from the same
+ *  formulas as eqmath_biquad_prepare_peakingeq(), so each iteration is a handful of arithmetic per
+ *  band and grid point plus one small linear solve. Once the continuous fit has converged, each Q
+ *  factor is snapped to the nearest of the eq_q_values and the gains are fitted again.
+ *
+ *  A fit can also run on a worker thread as an autoeq_job, which publishes every improved solution
+ *  so that the user interface can show the fit as it converges.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_AUTOEQ_H
+#define INCLUDED_AUTOEQ_H
+
+#include <stdbool.h>
+#include <pthread.h> // pthread_t, pthread_mutex_t
+#include "eq.h"
+
+#define AUTOEQ_OVERSAMPLING 4   /**< \brief Grid points per band frequency. */
+#define AUTOEQ_ITERATIONS 100   /**< \brief Most iterations of each of the two phases. */
+#define AUTOEQ_TOLERANCE 1e-2   /**< \brief Relative decrease of the error below which a phase stops. */
+
+/** \brief Weight of the penalty which keeps the Q factors near their initial values where the
+ *         target does not constrain them, per band and squared natural log of the ratio, relative
+ *         to squared dB of error per grid point.
+ */
+#define AUTOEQ_Q_WEIGHT 0.1
+
+/** \brief Fit of an equalizer running on a worker thread. */
+typedef struct autoeq_job {
+    pthread_t thread;
+    pthread_mutex_t lock;       /**< \brief Guards every field below. */
+    equalizer eq;               /**< \brief Best solution so far. */
+    double *target_db;
+    double rms_db;              /**< \brief RMS error of eq, in dB. */
+    bool updated;               /**< \brief eq changed since the last autoeq_job_poll(). */
+    bool running;
+    bool cancel;
+} autoeq_job;
+
+/** \brief Read a target curve from a text file and interpolate it at the band frequencies.
+ *
+ *  Every line starting with a number holds a frequency in Hz and a level in dB, separated by
+ *  whitespace or a comma, in increasing order of frequency; other lines, such as headers, are
+ *  ignored. The curve is interpolated linearly over the logarithm of the frequency and extended
+ *  flat beyond its ends.
+ *
+ *  \param[in]  filename   Path to the text file.
+ *  \param[in]  eq         Pointer to equalizer whose band frequencies to interpolate at.
+ *  \param[out] target_db  Array of eq->nfreq doubles to receive the target.
+ *
+ *  \return Empty string on success, description of the error otherwise.
+ */
+char *autoeq_load_target(const char *filename, const equalizer *eq, double *target_db);
+
+/** \brief Fit the gains and Q factors of an equalizer to a target curve.
+ *
+ *  \param[in,out] eq             Pointer to equalizer to fit. Its frequencies are kept, its Q
+ *                                factors are the starting point of the fit.
+ *  \param[in]     target_db      Array of eq->nfreq target levels in dB, at the band frequencies.
+ *  \param[in]     step_callback  Function called with every improved solution and its RMS error
+ *                                in dB, returning false to stop the fit early; or NULL.
+ *  \param[in]     context        Passed on to step_callback.
+ *
+ *  \return RMS error of the final solution over the fitting grid, in dB.
+ */
+double autoeq_fit(equalizer *eq, const double *target_db,
+                  bool (*step_callback)(const equalizer *eq, double rms_db, void *context),
+                  void *context);
+
+/** \brief Start fitting an equalizer on a worker thread.
+ *
+ *  \param[out] job        Pointer to the job to start.
+ *  \param[in]  eq         Pointer to equalizer to start the fit from; it is copied.
+ *  \param[in]  target_db  Array of eq->nfreq target levels in dB; it is copied.
+ */
+void autoeq_job_start(autoeq_job *job, const equalizer *eq, const double *target_db);
+
+/** \brief Fetch the latest solution of a running fit.
+ *
+ *  \param[in,out] job     Pointer to a started job.
+ *  \param[in,out] eq      Pointer to equalizer to receive the solution, if there is a newer one.
+ *  \param[out]    rms_db  Pointer to receive its RMS error in dB.
+ *
+ *  \return Whether the fit is still running.
+ */
+bool autoeq_job_poll(autoeq_job *job, equalizer *eq, double *rms_db);
+
+/** \brief Stop a fit if it is still running and release the job.
+ *
+ *  \param[in,out] job  Pointer to a started job.
+ */
+void autoeq_job_finish(autoeq_job *job);
+
+/** \} */
+
+#endif // INCLUDED_AUTOEQ_H
@@ -0,0 +1,585 @@
+#include "bench.h"
+#include "eq.h"
+#include "eqmath.h"
+#include "sound.h"
+#include "convert.h"
+#include "autoeq.h"
+
+#include <stdint.h> // uint32_t
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp, memset
+#include <math.h>   // sin, cos, exp, log, log10, sqrt, fabs, fmax, INFINITY
+#include <time.h>   // clock, clock_t
+
+#define PI 3.14159265358979323846
+
+static void ignore_progress(double progress) {
+    (void) progress;
+}
+
+// Seconds taken by one render of in, best of 3 to keep scheduling noise out.
+static double time_render(const equalizer *eq, const sound *in) {
+    double best = 0.0;
+    for(int run = 0; run < 3; run++) {
+        sound out = { 0 };
+        const clock_t start = clock();
+        eqmath_process(eq, in, &out, ignore_progress);
+        const double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+        if(run == 0 || elapsed < best) best = elapsed;
+        sound_delete(&out);
+    }
+    return best;
+}
+
+// uniform in [-1; 1), xorshift32
+static double noise(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state * (2.0 / 4294967296.0) - 1.0;
+}
+
+void bench_denormals(FILE *out, int nfreq) {
+    equalizer eq = { 0 };
+    eq_init(&eq, nfreq);
+    eqmath_init(&eq);
+    for(int i = 0; i < nfreq; i++) {
+        eq.gain_db[i] = HIGAIN;
+        eq_set_q_option(&eq, i, 9);
+    }
+
+    const char *names[3] = { "silence", "impulse", "noise burst" };
+    sound signals[3] = { { 0 } };
+    for(int k = 0; k < 3; k++) sound_init(&signals[k], BENCH_SECONDS * SAMPLERATE);
+    signals[1].samples[0] = 1.0;
+    uint32_t state = 0x2545f491;
+    for(int i = 0; i < SAMPLERATE / 2; i++) signals[2].samples[i] = 0.5 * noise(&state);
+
+    const eqmath_engine engines[2] = { EQMATH_SERIAL, EQMATH_PARALLEL };
+    const char *engine_names[2] = { "serial", "parallel" };
+    const eqmath_engine selected_engine = eqmath_get_engine();
+    const eqmath_denormals selected_denormals = eqmath_get_denormals();
+
+    fprintf(out, "Subnormal numbers, %d bands, %d s of audio\n", nfreq, BENCH_SECONDS);
+    fprintf(out, "%-10s %-12s %10s %10s %8s\n", "engine", "input", "keep", "flush", "speedup");
+    for(int e = 0; e < 2; e++) {
+        eqmath_set_engine(engines[e]);
+        for(int k = 0; k < 3; k++) {
+            eqmath_set_denormals(EQMATH_DENORMALS_KEEP);
+            const double keep = time_render(&eq, &signals[k]);
+            eqmath_set_denormals(EQMATH_DENORMALS_FLUSH);
+            const double flush = time_render(&eq, &signals[k]);
+            fprintf(out, "%-10s %-12s %9.3fs %9.3fs %7.1fx\n", engine_names[e], names[k], keep, flush,
+                    keep / flush);
+        }
+    }
+
+    eqmath_set_engine(selected_engine);
+    eqmath_set_denormals(selected_denormals);
+    for(int k = 0; k < 3; k++) sound_delete(&signals[k]);
+    eq_delete(&eq);
+}
+
+// The reference every variant is compared against: the cascade of eqmath_biquad_apply() with exact
+// IEEE arithmetic, whatever the engine and subnormal mode.
+static void render_reference(const equalizer *eq, const sound *in, sound *out) {
+    const eqmath_denormals selected = eqmath_get_denormals();
+    eqmath_set_denormals(EQMATH_DENORMALS_KEEP);
+
+    int *active = malloc(eq->nfreq * sizeof(int));
+    const int nactive = eq_active_bands(eq, active);
+    sound_copyinit(out, in);
+    sound tmp = { 0 };
+    sound_init(&tmp, in->num_samples);
+    for(int k = 0; k < nactive; k++) {
+        biquad filter;
+        eqmath_biquad_prepare_peakingeq(&filter, eq, active[k]);
+        eqmath_biquad_apply(&filter, out, &tmp);
+        const sound swap = *out;
+        *out = tmp;
+        tmp = swap;
+    }
+
+    sound_delete(&tmp);
+    free(active);
+    eqmath_set_denormals(selected);
+}
+
+static void render_process(const equalizer *eq, const sound *in, sound *out) {
+    eqmath_process(eq, in, out, ignore_progress);
+}
+
+#define CHECK_BLOCK 4096 // samples per block of the streamed variants
+
+static void render_stream(const equalizer *eq, const sound *in, sound *out) {
+    eqmath_stream stream = { 0 };
+    eqmath_stream_init(&stream, eq);
+    sound_copyinit(out, in);
+    for(int64_t start = 0; start < out->num_samples; start += CHECK_BLOCK)
+        eqmath_stream_run(&stream, out->samples + start,
+                          out->num_samples - start < CHECK_BLOCK ? out->num_samples - start : CHECK_BLOCK);
+    eqmath_stream_delete(&stream);
+}
+
+// Renders after one another reuse the checkpoints of the previous setting, as they would while
+// the user edits bands.
+static eqmath_stage_cache check_cache;
+
+static void render_cached(const equalizer *eq, const sound *in, sound *out) {
+    eqmath_process_cached(&check_cache, eq, in, out, ignore_progress);
+}
+
+#define CHECK_SEGMENTS 8 // independent ranges of the segmented variant
+
+static void render_segments(const equalizer *eq, const sound *in, sound *out) {
+    sound_init(out, in->num_samples);
+    for(int k = 0; k < CHECK_SEGMENTS; k++) {
+        const int64_t start = in->num_samples * k / CHECK_SEGMENTS;
+        const int64_t end = in->num_samples * (k + 1) / CHECK_SEGMENTS;
+        sound segment = { 0 };
+        eqmath_process_range(eq, in, start, end, &segment);
+        for(int64_t i = 0; i < end - start; i++) out->samples[start + i] = segment.samples[i];
+        sound_delete(&segment);
+    }
+}
+
+// Ranges are kept across settings and signals, and each signal is a new generation of input, so
+// a range of the wrong setting or signal would show up as an error.
+static eqmath_preview_cache check_previews;
+static unsigned long long check_generation;
+
+// The segments twice through the preview cache, keeping the second, cached, rendering.
+static void render_preview(const equalizer *eq, const sound *in, sound *out) {
+    sound_init(out, in->num_samples);
+    for(int k = 0; k < CHECK_SEGMENTS; k++) {
+        const int64_t start = in->num_samples * k / CHECK_SEGMENTS;
+        const int64_t end = in->num_samples * (k + 1) / CHECK_SEGMENTS;
+        sound segment = { 0 };
+        eqmath_preview(&check_previews, eq, in, check_generation, start, end, &segment);
+        eqmath_preview(&check_previews, eq, in, check_generation, start, end, &segment);
+        for(int64_t i = 0; i < end - start; i++) out->samples[start + i] = segment.samples[i];
+        sound_delete(&segment);
+    }
+}
+
+// A way of rendering which must match the reference, with the largest error it may have relative
+// to the peak of the reference.
+typedef struct check_variant {
+    const char *name;
+    eqmath_engine engine;
+    void (*render)(const equalizer *eq, const sound *in, sound *out);
+    double limit;
+} check_variant;
+
+static const check_variant check_variants[] = {
+    { "serial",        EQMATH_SERIAL,    render_process,  1e-12 },
+    { "parallel",      EQMATH_PARALLEL,  render_process,  1e-3 },
+    { "stream",        EQMATH_SERIAL,    render_stream,   1e-12 },
+    { "stream/par",    EQMATH_PARALLEL,  render_stream,   1e-3 },
+    { "cached",        EQMATH_SERIAL,    render_cached,   1e-12 },
+    { "segments",      EQMATH_SERIAL,    render_segments, 1e-5 },
+    { "preview",       EQMATH_SERIAL,    render_preview,  1e-5 }
+};
+
+#define CHECK_VARIANTS (int) (sizeof(check_variants) / sizeof(check_variants[0]))
+#define CHECK_SIGNALS 4
+#define CHECK_PATTERNS 4
+
+// Worst case of one variant on one signal over all settings.
+typedef struct check_result {
+    double max_error;           // relative to the peak of the reference
+    double min_snr_db;
+    double seconds, reference_seconds;
+} check_result;
+
+static void make_signal(sound *snd, int kind) {
+    sound_init(snd, BENCH_CHECK_SAMPLES);
+    const int64_t n = snd->num_samples;
+    uint32_t state = 0x2545f491;
+    for(int64_t i = 0; i < n; i++) {
+        if(kind == 0) snd->samples[i] = i == 0 ? 1.0 : 0.0;
+        // exponential sweep from 20 Hz to 20 kHz
+        if(kind == 1) snd->samples[i] = 0.5 * sin(2 * PI * 20.0 * n / SAMPLERATE / log(1000.0)
+                                                  * (exp(log(1000.0) * i / n) - 1));
+        if(kind == 2) snd->samples[i] = 0.5 * noise(&state);
+    }
+}
+
+// Gains of one of the test patterns, at the same Q factor for all bands.
+static void make_setting(equalizer *eq, int pattern, int q) {
+    uint32_t state = 0x9e3779b9 + q;
+    for(int i = 0; i < eq->nfreq; i++) {
+        if(pattern == 0) eq->gain_db[i] = i % 2 ? -6.0 : 6.0;
+        if(pattern == 1) eq->gain_db[i] = HIGAIN * noise(&state);
+        if(pattern == 2) eq->gain_db[i] = i == eq->nfreq / 3 ? 12.0 : 0.0;
+        if(pattern == 3) eq->gain_db[i] = 6.0 - 12.0 * i / (eq->nfreq - 1);
+        eq_set_q_option(eq, i, q);
+    }
+}
+
+static void compare(const sound *reference, const sound *candidate, check_result *result) {
+    double peak = 0.0, max_error = 0.0, signal = 0.0, error = 0.0;
+    for(int64_t i = 0; i < reference->num_samples; i++) {
+        const double d = fabs(candidate->samples[i] - reference->samples[i]);
+        if(!(d <= max_error)) max_error = d;  // NaN counts as the largest error
+        peak = fmax(peak, fabs(reference->samples[i]));
+        signal += reference->samples[i] * reference->samples[i];
+        error += d * d;
+    }
+
+    if(peak > 0.0) max_error /= peak;
+    const double snr_db = error == 0.0 ? INFINITY : signal == 0.0 ? -INFINITY : 10 * log10(signal / error);
+    if(!(max_error <= result->max_error)) result->max_error = max_error;
+    if(!(snr_db >= result->min_snr_db)) result->min_snr_db = snr_db;
+}
+
+// Worst deviation in dB of the magnitude response of the linear-phase engine from the cascade's,
+// at the frequencies of the bands, measured on its impulse response.
+static double linear_phase_error_db(const equalizer *eq) {
+    const eqmath_engine selected = eqmath_get_engine();
+    eqmath_set_engine(EQMATH_LINEAR_PHASE);
+    sound impulse = { 0 }, response = { 0 };
+    sound_init(&impulse, FIR_TAPS + 1);
+    impulse.samples[(FIR_TAPS + 1) / 2] = 1.0;
+    eqmath_process(eq, &impulse, &response, ignore_progress);
+    eqmath_set_engine(selected);
+
+    double *target = malloc(eq->nfreq * sizeof(double));
+    eqmath_overall_frequency_response(eq, target);
+    double worst = 0.0;
+    for(int i = 0; i < eq->nfreq; i++) {
+        // one DFT bin, turning a phasor by exp(-i w) per sample, renormalised now and then
+        const double w = 2 * PI * eq->freqs[i] / SAMPLERATE;
+        const double step_re = cos(w), step_im = -sin(w);
+        double re = 0.0, im = 0.0, phasor_re = 1.0, phasor_im = 0.0;
+        for(int64_t t = 0; t < response.num_samples; t++) {
+            re += response.samples[t] * phasor_re;
+            im += response.samples[t] * phasor_im;
+            const double next_re = phasor_re * step_re - phasor_im * step_im;
+            phasor_im = phasor_re * step_im + phasor_im * step_re;
+            phasor_re = next_re;
+            if(t % 1024 == 1023) {
+                const double norm = sqrt(phasor_re * phasor_re + phasor_im * phasor_im);
+                phasor_re /= norm;
+                phasor_im /= norm;
+            }
+        }
+        worst = fmax(worst, fabs(eqmath_gain_to_db(sqrt(re * re + im * im)) - eqmath_gain_to_db(target[i])));
+    }
+
+    free(target);
+    sound_delete(&impulse);
+    sound_delete(&response);
+    return worst;
+}
+
+// The linear-phase engine is checked on its magnitude only. The worst case is a pair of deep cuts
+// at the highest Q near LOFREQ, a few Hz wide, whose response outlasts the filter: about 0.5dB.
+#define CHECK_LINEAR_LIMIT_DB 0.6
+
+bool bench_check(FILE *out, int nfreq) {
+    const char *signal_names[CHECK_SIGNALS] = { "impulse", "sweep", "noise", "silence" };
+    check_result results[CHECK_VARIANTS][CHECK_SIGNALS];
+    for(int v = 0; v < CHECK_VARIANTS; v++)
+        for(int k = 0; k < CHECK_SIGNALS; k++)
+            results[v][k] = (check_result) { 0.0, INFINITY, 0.0, 0.0 };
+
+    equalizer eq = { 0 };
+    eq_init(&eq, nfreq);
+    eqmath_init(&eq);
+    const eqmath_engine selected_engine = eqmath_get_engine();
+    eqmath_stage_cache_init(&check_cache, 1ull << 30);
+    eqmath_preview_cache_init(&check_previews);
+
+    double linear_errors[CHECK_PATTERNS] = { 0.0 };
+    for(int pattern = 0; pattern < CHECK_PATTERNS; pattern++) {
+        for(int q = 0; q < 10; q++) {
+            make_setting(&eq, pattern, q);
+            const double error = linear_phase_error_db(&eq);
+            if(!(error <= linear_errors[pattern])) linear_errors[pattern] = error;
+        }
+    }
+
+    for(int k = 0; k < CHECK_SIGNALS; k++) {
+        sound in = { 0 };
+        make_signal(&in, k);
+        eqmath_stage_cache_invalidate(&check_cache);
+        check_generation++;
+
+        for(int pattern = 0; pattern < CHECK_PATTERNS; pattern++) {
+            for(int q = 0; q < 10; q++) {
+                make_setting(&eq, pattern, q);
+
+                sound reference = { 0 };
+                clock_t start = clock();
+                render_reference(&eq, &in, &reference);
+                const double reference_seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+                for(int v = 0; v < CHECK_VARIANTS; v++) {
+                    sound candidate = { 0 };
+                    eqmath_set_engine(check_variants[v].engine);
+                    start = clock();
+                    check_variants[v].render(&eq, &in, &candidate);
+                    results[v][k].seconds += (double) (clock() - start) / CLOCKS_PER_SEC;
+                    results[v][k].reference_seconds += reference_seconds;
+                    compare(&reference, &candidate, &results[v][k]);
+                    sound_delete(&candidate);
+                }
+                sound_delete(&reference);
+            }
+        }
+        sound_delete(&in);
+    }
+
+    fprintf(out, "Accuracy against the double precision cascade, %d bands, %.2f s of audio,\n"
+                 "%d gain patterns at each of the 10 Q factors\n", nfreq, (double) BENCH_CHECK_SAMPLES / SAMPLERATE,
+            CHECK_PATTERNS);
+    fprintf(out, "%-11s %-8s %10s %9s %9s %9s %8s %9s\n", "variant", "signal", "max error", "min SNR",
+            "reference", "time", "speedup", "limit");
+    bool passed = true;
+    for(int v = 0; v < CHECK_VARIANTS; v++) {
+        for(int k = 0; k < CHECK_SIGNALS; k++) {
+            const check_result *r = &results[v][k];
+            const bool pass = r->max_error <= check_variants[v].limit;
+            passed = passed && pass;
+            fprintf(out, "%-11s %-8s %10.2e %7.1fdB %8.3fs %8.3fs %7.2fx %9.0e %s\n", check_variants[v].name,
+                    signal_names[k], r->max_error, r->min_snr_db, r->reference_seconds, r->seconds,
+                    r->reference_seconds / r->seconds, check_variants[v].limit, pass ? "pass" : "FAIL");
+        }
+    }
+
+    const char *pattern_names[CHECK_PATTERNS] = { "alternate", "random", "single", "tilt" };
+    fprintf(out, "\nMagnitude of the linear-phase filter against the cascade's, at the band frequencies\n");
+    fprintf(out, "%-11s %-9s %10s %9s\n", "variant", "gains", "max error", "limit");
+    for(int pattern = 0; pattern < CHECK_PATTERNS; pattern++) {
+        const bool pass = linear_errors[pattern] <= CHECK_LINEAR_LIMIT_DB;
+        passed = passed && pass;
+        fprintf(out, "%-11s %-9s %8.2fdB %7.1fdB %s\n", "linear", pattern_names[pattern],
+                linear_errors[pattern], CHECK_LINEAR_LIMIT_DB, pass ? "pass" : "FAIL");
+    }
+
+    eqmath_set_engine(selected_engine);
+    eqmath_stage_cache_delete(&check_cache);
+    eqmath_preview_cache_delete(&check_previews);
+    eq_delete(&eq);
+    return passed;
+}
+
+// Odd, so that every vector kernel leaves a tail to the plain C code, and more than one staging
+// block of the 8 and 24-bit conversions.
+#define CHECK_CONVERT_SAMPLES 4099
+
+bool bench_check_convert(FILE *out) {
+    const char *type_names[CONVERT_TYPES] = { "u8", "s16", "s24", "s32", "f32", "f64" };
+    const char *isa_names[] = { "scalar", "sse2", "avx2", "avx512" };
+    const int n = CHECK_CONVERT_SAMPLES;
+
+    // samples across the range, then the edges: full scale, rounding ties, out of range,
+    // subnormal, infinite and NaN values
+    double *samples = malloc(n * sizeof(double));
+    uint32_t state = 0x2545f491;
+    for(int i = 0; i < n; i++) samples[i] = 1.25 * noise(&state);
+    const double edges[] = { 0.0, -0.0, 1.0, -1.0, 0.5 / 32767.0, -0.5 / 32767.0, 1.5 / 32767.0,
+                             0.5 / 8388607.0, 0.5 / 128.0, 1.0 + 1e-9, -1.0 - 1e-9, 2.0, -2.0, 1e300,
+                             -1e300, 4.9e-324, 1e-40, INFINITY, -INFINITY, NAN, -NAN };
+    for(int i = 0; i < (int) (sizeof(edges) / sizeof(edges[0])); i++) samples[n - 1 - i] = edges[i];
+
+    // raw bytes of every format, NaN and subnormal floats included
+    unsigned char *raw = malloc(n * sizeof(double));
+    for(size_t i = 0; i < n * sizeof(double); i++) raw[i] = (unsigned char) (noise(&state) * 128.0 + 128.0);
+
+    unsigned char *reference = malloc(n * sizeof(double)), *candidate = malloc(n * sizeof(double));
+
+    const convert_isa selected = convert_current_isa(), best = convert_best_isa();
+    fprintf(out, "Sample conversion kernels against the plain C ones, %d samples\n", n);
+    fprintf(out, "%-7s %-5s %-10s %s\n", "isa", "type", "direction", "result");
+    bool passed = true;
+    for(convert_isa isa = CONVERT_SSE2; isa <= best; isa++) {
+        for(convert_type type = 0; type < CONVERT_TYPES; type++) {
+            for(int direction = 0; direction < 2; direction++) {
+                // the outputs are filled with different bytes, so that a sample left unwritten differs
+                memset(reference, 0x55, n * sizeof(double));
+                memset(candidate, 0xaa, n * sizeof(double));
+                const size_t size = n * (direction ? (size_t) convert_bytes(type) : sizeof(double));
+
+                convert_use_isa(CONVERT_SCALAR);
+                if(direction) convert_from_double(type, samples, reference, n);
+                else convert_to_double(type, raw, (double*) reference, n);
+                convert_use_isa(isa);
+                if(direction) convert_from_double(type, samples, candidate, n);
+                else convert_to_double(type, raw, (double*) candidate, n);
+
+                const bool pass = memcmp(reference, candidate, size) == 0;
+                passed = passed && pass;
+                fprintf(out, "%-7s %-5s %-10s %s\n", isa_names[isa], type_names[type],
+                        direction ? "to PCM" : "to double", pass ? "pass" : "FAIL");
+            }
+        }
+    }
+    if(best == CONVERT_SCALAR) fprintf(out, "No vector kernels on this CPU\n");
+
+    convert_use_isa(selected);
+    free(samples);
+    free(raw);
+    free(reference);
+    free(candidate);
+    return passed;
+}
+
+// Level in dB of one of the target curves of the auto-EQ check at a frequency: smooth shapes like
+// those of headphone and room targets, which every number of bands can follow.
+static double target_level_db(int kind, double freq) {
+    const double octaves = log(freq / 1000.0) / log(2.0); // from 1 kHz
+    if(kind == 0) return -0.6 * octaves;                                    // tilt
+    if(kind == 1) return 8.0 / (1.0 + (freq / 120.0) * (freq / 120.0));     // bass shelf
+    if(kind == 2) return 5.0 * exp(-(octaves - 1.5) * (octaves - 1.5));     // presence bump
+    // all of them, with a dip at 6 kHz
+    return -0.6 * octaves + 8.0 / (1.0 + (freq / 120.0) * (freq / 120.0)) + 5.0 * exp(-(octaves - 1.5) * (octaves - 1.5))
+           - 4.0 * exp(-4.0 * (octaves - 2.6) * (octaves - 2.6));
+}
+
+#define CHECK_TARGETS 4
+#define CHECK_AUTOEQ_RMS_DB 0.2     // over the fitting grid
+#define CHECK_AUTOEQ_SECONDS 1.0    // per fit, for the fit to follow in the user interface
+
+bool bench_check_autoeq(FILE *out, int nfreq) {
+    const char *target_names[CHECK_TARGETS] = { "tilt", "bass", "presence", "combined" };
+    equalizer eq = { 0 };
+    double *target_db = malloc(nfreq * sizeof(double));
+
+    fprintf(out, "Auto-EQ fits to smooth target curves, %d bands\n", nfreq);
+    fprintf(out, "%-9s %10s %9s %9s %9s\n", "target", "RMS error", "limit", "time", "limit");
+    bool passed = true;
+    for(int kind = 0; kind < CHECK_TARGETS; kind++) {
+        // from a flat equalizer at the default Q factor
+        eq_init(&eq, nfreq);
+        for(int i = 0; i < nfreq; i++) target_db[i] = target_level_db(kind, eq.freqs[i]);
+
+        const clock_t start = clock();
+        const double rms_db = autoeq_fit(&eq, target_db, NULL, NULL);
+        const double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+        const bool pass = rms_db <= CHECK_AUTOEQ_RMS_DB && seconds <= CHECK_AUTOEQ_SECONDS;
+        passed = passed && pass;
+        fprintf(out, "%-9s %8.3fdB %7.1fdB %8.3fs %8.1fs %s\n", target_names[kind], rms_db, CHECK_AUTOEQ_RMS_DB,
+                seconds, CHECK_AUTOEQ_SECONDS, pass ? "pass" : "FAIL");
+    }
+
+    free(target_db);
+    eq_delete(&eq);
+    return passed;
+}
+
+void bench_cascade(FILE *out, int nfreq) {
+    equalizer eq = { 0 };
+    eq_init(&eq, nfreq);
+    eqmath_init(&eq);
+    biquad *filters = malloc(nfreq * sizeof(biquad));
+    biquad_state *states = malloc(nfreq * sizeof(biquad_state));
+    uint32_t state = 0x2545f491;
+    for(int i = 0; i < nfreq; i++) {
+        eq.gain_db[i] = HIGAIN * noise(&state);
+        eqmath_biquad_prepare_peakingeq(&filters[i], &eq, i);
+    }
+
+    const int64_t n = BENCH_SECONDS * SAMPLERATE;
+    double *x = malloc(n * sizeof(double));
+
+    fprintf(out, "Cascade kernels, %d s of audio in blocks of %d\n", BENCH_SECONDS, CHECK_BLOCK);
+    fprintf(out, "%-6s %10s %10s %8s\n", "bands", "filters", "cascade", "speedup");
+    for(int count = 1; ; count = 2 * count < nfreq ? 2 * count : nfreq) {
+        double seconds[2];
+        for(int kind = 0; kind < 2; kind++) {
+            for(int64_t i = 0; i < n; i++) x[i] = 0.5 * noise(&state);
+            for(int k = 0; k < count; k++) states[k] = (biquad_state) { 0 };
+
+            const clock_t start = clock();
+            for(int64_t block = 0; block < n; block += CHECK_BLOCK) {
+                const int len = n - block < CHECK_BLOCK ? n - block : CHECK_BLOCK;
+                if(kind == 0)
+                    for(int k = 0; k < count; k++)
+                        eqmath_biquad_run(&filters[k], &states[k], x + block, x + block, len);
+                if(kind == 1) eqmath_cascade_run(filters, states, count, x + block, len);
+            }
+            seconds[kind] = (double) (clock() - start) / CLOCKS_PER_SEC;
+        }
+        fprintf(out, "%-6d %9.3fs %9.3fs %7.2fx\n", count, seconds[0], seconds[1],
+                seconds[0] / seconds[1]);
+        if(count == nfreq) break;
+    }
+
+    free(x);
+    free(filters);
+    free(states);
+    eq_delete(&eq);
+}
+
+void bench_linear_phase(FILE *out, int nfreq) {
+    equalizer eq = { 0 };
+    eq_init(&eq, nfreq);
+    eqmath_init(&eq);
+
+    sound in = { 0 };
+    sound_init(&in, BENCH_LONG_SECONDS * SAMPLERATE);
+    uint32_t state = 0x2545f491;
+    for(int64_t i = 0; i < in.num_samples; i++) in.samples[i] = 0.5 * noise(&state);
+    const eqmath_engine selected = eqmath_get_engine();
+
+    fprintf(out, "Linear phase against the cascade, %d s of audio\n", BENCH_LONG_SECONDS);
+    fprintf(out, "%-6s %10s %10s %8s %10s %10s\n", "bands", "cascade", "linear", "speedup", "design",
+            "max error");
+    for(int count = 1; ; count = 4 * count < nfreq ? 4 * count : nfreq) {
+        // the first count bands active, at random gains
+        for(int i = 0; i < nfreq; i++) eq.gain_db[i] = i < count ? HIGAIN * noise(&state) : 0.0;
+
+        eqmath_set_engine(EQMATH_SERIAL);
+        const double cascade = time_render(&eq, &in);
+        eqmath_set_engine(EQMATH_LINEAR_PHASE);
+        const double linear = time_render(&eq, &in);
+
+        eqmath_stream stream = { 0 };
+        const clock_t start = clock();
+        eqmath_stream_init(&stream, &eq);
+        const double design = (double) (clock() - start) / CLOCKS_PER_SEC;
+        eqmath_stream_delete(&stream);
+
+        fprintf(out, "%-6d %9.3fs %9.3fs %7.2fx %9.3fs %8.2fdB\n", count, cascade, linear, cascade / linear,
+                design, linear_phase_error_db(&eq));
+        if(count == nfreq) break;
+    }
+
+    // a stream of the linear-phase filter only delays, the others have no latency
+    eqmath_stream stream = { 0 };
+    eqmath_stream_init(&stream, &eq);
+    const int latency = eqmath_stream_latency(&stream);
+    eqmath_stream_delete(&stream);
+    fprintf(out, "Streaming latency: %d samples, %.1f ms (filter delay %d, block of %d)\n", latency,
+            1000.0 * latency / SAMPLERATE, FIR_TAPS / 2, FIR_BLOCK);
+
+    eqmath_set_engine(selected);
+    sound_delete(&in);
+    eq_delete(&eq);
+}
+
+bool bench_check_all(FILE *out, int nfreq) {
+    const int band_counts[] = BENCH_CHECK_BAND_COUNTS;
+    const int counts = nfreq != 0 ? 1 : (int) (sizeof(band_counts) / sizeof(band_counts[0]));
+
+    bool passed = bench_check_convert(out);
+    for(int k = 0; k < counts; k++) {
+        const int bands = nfreq != 0 ? nfreq : band_counts[k];
+        fprintf(out, "\n");
+        passed = bench_check(out, bands) && passed;
+        fprintf(out, "\n");
+        passed = bench_check_autoeq(out, bands) && passed;
+    }
+    return passed;
+}
+
+void bench_run(FILE *out, int nfreq) {
+    bench_denormals(out, nfreq);
+    fprintf(out, "\n");
+    bench_cascade(out, nfreq);
+    fprintf(out, "\n");
+    bench_linear_phase(out, nfreq);
+}
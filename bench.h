@@ -0,0 +1,135 @@
+/** \file bench.h
+ *  \defgroup bench Benchmark module
+ *  \{
+ *  \brief The bench module times renders of synthetic signals under different processing modes,
+ *         printing the results as tables. It is run with `kayeq --bench`.
+ *
+ *  It also checks that every optimised way of rendering, run with `kayeq --check` or with the
+ *  separate kayeq_check program, which has no user interface and builds on any platform, stays
+ *  within a fixed error of the reference: the double precision cascade of eqmath_biquad_apply()
+ *  with exact IEEE arithmetic.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_BENCH_H
+#define INCLUDED_BENCH_H
+
+#include <stdbool.h>
+#include <stdio.h> // FILE
+#include "sound.h" // SAMPLERATE
+#include "eq.h"    // NFREQ
+
+#define BENCH_SECONDS 10        /**< \brief Length of each test signal. */
+#define BENCH_LONG_SECONDS 60   /**< \brief Length of the signal the linear-phase engine is timed on. */
+
+/** \brief Length of each signal of the accuracy check, in samples. */
+#define BENCH_CHECK_SAMPLES (SAMPLERATE / 4)
+
+/** \brief Time renders of silent and decaying signals with subnormal numbers kept and flushed.
+ *
+ *  All bands are boosted with the highest Q factor, so that the filters ring as long as they can.
+ *  The signals are digital silence, a single impulse followed by silence, and half a second of
+ *  noise followed by silence.
+ *
+ *  \param[out] out    Stream to print the table to.
+ *  \param[in]  nfreq  Number of bands of the equalizer.
+ */
+void bench_denormals(FILE *out, int nfreq);
+
+/** \brief Time the filters of a cascade run one after another by eqmath_biquad_run(), against the
+ *         fused kernels of eqmath_cascade_run().
+ *
+ *  The bands have random gains; the cascade is timed with 1, 2, 4, ... and nfreq of them.
+ *
+ *  \param[out] out    Stream to print the table to.
+ *  \param[in]  nfreq  Number of bands of the equalizer.
+ */
+void bench_cascade(FILE *out, int nfreq);
+
+/** \brief Time renders of a long signal by the cascade and by the linear-phase engine, with more
+ *         and more active bands, and print the latency of a linear-phase stream.
+ *
+ *  Each row also gives the time taken to design the linear-phase filter, which every stream
+ *  initialisation pays, and the largest deviation of its magnitude response from the cascade's,
+ *  in dB at the frequencies of the bands.
+ *
+ *  \param[out] out    Stream to print the table to.
+ *  \param[in]  nfreq  Number of bands of the equalizer.
+ */
+void bench_linear_phase(FILE *out, int nfreq);
+
+/** \brief Compare every rendering variant to the reference on synthetic signals, printing the
+ *         worst error, SNR and time of each next to the reference's.
+ *
+ *  The variants are the serial and parallel engines through eqmath_process(), the
+ *  cascade and the parallel form run block by block through an eqmath_stream, renders through a
+ *  stage cache which resume from the previous setting's checkpoints, renders split into ranges processed
+ *  independently by eqmath_process_range(), and the same ranges rendered twice through a preview
+ *  cache, keeping the cached copies. The signals are an impulse, an exponential sine
+ *  sweep, white noise and silence; the settings are four gain patterns at each of the Q factors.
+ *  Errors are relative to the peak of the reference output, and each variant has its own limit.
+ *
+ *  The linear-phase engine is left out of that comparison, since its phase differs from the
+ *  cascade's by design. Only its magnitude response is checked instead, at the frequencies of the
+ *  bands for the same settings, to within a fraction of a dB: the narrowest bands near LOFREQ
+ *  are only a few times wider than its resolution.
+ *
+ *  \param[out] out    Stream to print the table to.
+ *  \param[in]  nfreq  Number of bands of the equalizer.
+ *
+ *  \return Whether every variant stayed within its limit.
+ */
+bool bench_check(FILE *out, int nfreq);
+
+/** \brief Check that every sample conversion kernel the CPU supports gives the same bytes as the
+ *         plain C one, in both directions and for every format.
+ *
+ *  The samples cover the whole range and its edges: full scale, rounding ties, values out of
+ *  range, subnormal, infinite and NaN values. The conversions in the other direction start from
+ *  random bytes, which include NaN and subnormal floats. The kernels selected before are restored.
+ *
+ *  \param[out] out  Stream to print the table to.
+ *
+ *  \return Whether every kernel matched.
+ */
+bool bench_check_convert(FILE *out);
+
+/** \brief Check that autoeq_fit() matches known target curves within a fixed RMS error and time.
+ *
+ *  The targets are smooth shapes like those of headphone and room targets: a tilt, a bass shelf,
+ *  a presence bump and the three combined with a dip. Every fit starts from a flat equalizer.
+ *
+ *  \param[out] out    Stream to print the table to.
+ *  \param[in]  nfreq  Number of bands of the equalizer.
+ *
+ *  \return Whether every fit stayed within both limits.
+ */
+bool bench_check_autoeq(FILE *out, int nfreq);
+
+/** \brief Band counts the checks run at by default: those of octave, third-octave and the
+ *         default equalizer.
+ */
+#define BENCH_CHECK_BAND_COUNTS { 10, 31, NFREQ }
+
+/** \brief Run every check: the conversion kernels once, then the rendering variants and the
+ *         auto-EQ fit at each number of bands.
+ *
+ *  \param[out] out    Stream to print the tables to.
+ *  \param[in]  nfreq  Number of bands to check at, or 0 for each of BENCH_CHECK_BAND_COUNTS.
+ *
+ *  \return Whether every check passed.
+ */
+bool bench_check_all(FILE *out, int nfreq);
+
+/** \brief Run all benchmarks.
+ *
+ *  \param[out] out    Stream to print the tables to.
+ *  \param[in]  nfreq  Number of bands of the equalizer.
+ */
+void bench_run(FILE *out, int nfreq);
+
+/** \} */
+
+#endif // INCLUDED_BENCH_H
@@ -0,0 +1,239 @@
+#include "cache.h"
+
+#include <stdio.h>  // FILE, fopen, fread, fwrite, fscanf, fprintf, fclose, remove, snprintf
+#include <stdlib.h> // realloc, free
+#include <string.h> // memcpy, memcmp, memset, strlen
+
+static const char magic[4] = { 'K', 'E', 'Q', 'C' };
+
+/** \brief One render in the index of the disk tier. */
+typedef struct disk_entry {
+    unsigned long long name, bytes, last_used;
+} disk_entry;
+
+uint64_t cache_hash_sound(const sound *snd) {
+    return eq_fnv1a(EQ_FNV1A_BASIS, snd->samples, snd->num_samples * sizeof(double));
+}
+
+static bool key_equal(const cache_key *a, const cache_key *b) {
+    return a->input_hash == b->input_hash && a->num_samples == b->num_samples &&
+           a->eq_hash == b->eq_hash && a->engine == b->engine && a->denormals == b->denormals;
+}
+
+static void path_of(const cache *c, unsigned long long name, char *path, size_t size) {
+    if(name == 0)
+        snprintf(path, size, "%s/%s", c->directory, CACHE_INDEX);
+    else
+        snprintf(path, size, "%s/%016llx.keqc", c->directory, name);
+}
+
+// Reads the index of the disk tier, which is empty if missing. Returns the number of entries.
+static int read_index(const cache *c, disk_entry **entries) {
+    char path[CACHE_PATH + 32];
+    path_of(c, 0, path, sizeof(path));
+    *entries = NULL;
+
+    FILE *index = fopen(path, "r");
+    if(index == NULL) return 0;
+
+    int n = 0;
+    disk_entry entry;
+    while(fscanf(index, "%llx %llu %llu", &entry.name, &entry.bytes, &entry.last_used) == 3) {
+        *entries = realloc(*entries, (n + 1) * sizeof(disk_entry));
+        (*entries)[n++] = entry;
+    }
+    fclose(index);
+    return n;
+}
+
+static void write_index(const cache *c, const disk_entry *entries, int n) {
+    char path[CACHE_PATH + 32];
+    path_of(c, 0, path, sizeof(path));
+
+    FILE *index = fopen(path, "w");
+    if(index == NULL) return;
+    for(int i = 0; i < n; i++)
+        fprintf(index, "%016llx %llu %llu\n", entries[i].name, entries[i].bytes, entries[i].last_used);
+    fclose(index);
+}
+
+// Records a use of a render in the index, then evicts the least recently used other renders
+// until all fit in the budget. A render of zero bytes was not stored, so it is removed instead.
+static void touch_index(const cache *c, unsigned long long name, unsigned long long bytes) {
+    disk_entry *entries;
+    int n = read_index(c, &entries);
+
+    unsigned long long clock = 0, total = 0;
+    int found = -1;
+    for(int i = 0; i < n; i++) {
+        if(entries[i].last_used > clock) clock = entries[i].last_used;
+        if(entries[i].name == name) found = i;
+        else total += entries[i].bytes;
+    }
+    if(found < 0) {
+        entries = realloc(entries, (n + 1) * sizeof(disk_entry));
+        found = n++;
+    }
+    entries[found].name = name;
+    entries[found].bytes = bytes;
+    entries[found].last_used = clock + 1;
+    total += bytes;
+
+    char path[CACHE_PATH + 32];
+    if(bytes == 0) {
+        path_of(c, name, path, sizeof(path));
+        remove(path);
+        entries[found] = entries[--n];
+        found = -1;
+    }
+    while(total > c->disk_budget) {
+        int victim = -1;
+        for(int i = 0; i < n; i++)
+            if(i != found && (victim < 0 || entries[i].last_used < entries[victim].last_used))
+                victim = i;
+        if(victim < 0) break;
+
+        path_of(c, entries[victim].name, path, sizeof(path));
+        remove(path);
+        total -= entries[victim].bytes;
+        entries[victim] = entries[--n];
+        if(found == n) found = victim;
+    }
+
+    write_index(c, entries, n);
+    free(entries);
+}
+
+static bool disk_load(const cache *c, const cache_key *key, sound *out, sound_stats *stats) {
+    char path[CACHE_PATH + 32];
+    const unsigned long long name = eq_fnv1a(EQ_FNV1A_BASIS, key, sizeof(*key));
+    path_of(c, name, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return false;
+
+    char file_magic[4];
+    cache_key file_key;
+    bool ok = fread(file_magic, sizeof(file_magic), 1, file) == 1 &&
+              memcmp(file_magic, magic, sizeof(magic)) == 0 &&
+              fread(&file_key, sizeof(file_key), 1, file) == 1 && key_equal(&file_key, key) &&
+              fread(stats, sizeof(*stats), 1, file) == 1 &&
+              sound_memory_allows(key->num_samples * sizeof(double)) &&
+              sound_init(out, key->num_samples) &&
+              fread(out->samples, sizeof(double), key->num_samples, file) == (size_t) key->num_samples;
+    fclose(file);
+
+    if(!ok) {
+        sound_delete(out);
+        return false;
+    }
+    touch_index(c, name, sizeof(magic) + sizeof(*key) + sizeof(*stats) + key->num_samples * sizeof(double));
+    return true;
+}
+
+static void disk_store(const cache *c, const cache_key *key, const sound *samples, const sound_stats *stats) {
+    const unsigned long long bytes = sizeof(magic) + sizeof(*key) + sizeof(*stats) +
+                                     samples->num_samples * sizeof(double);
+    if(bytes > c->disk_budget) return;
+
+    char path[CACHE_PATH + 32];
+    const unsigned long long name = eq_fnv1a(EQ_FNV1A_BASIS, key, sizeof(*key));
+    path_of(c, name, path, sizeof(path));
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL) return;
+    bool ok = fwrite(magic, sizeof(magic), 1, file) == 1 &&
+              fwrite(key, sizeof(*key), 1, file) == 1 &&
+              fwrite(stats, sizeof(*stats), 1, file) == 1 &&
+              fwrite(samples->samples, sizeof(double), samples->num_samples, file) == (size_t) samples->num_samples;
+    ok = fclose(file) == 0 && ok;
+
+    // a partial file would only be rejected when read, so leave none behind
+    touch_index(c, name, ok ? bytes : 0);
+}
+
+static void memory_store(cache *c, const cache_key *key, const sound *samples, const sound_stats *stats) {
+    const unsigned long long bytes = samples->num_samples * sizeof(double);
+    if(bytes > c->memory_budget || !sound_memory_allows(bytes)) return;
+
+    // evict until both an entry and enough of the budget are free
+    for(;;) {
+        unsigned long long used = 0;
+        int victim = -1, free_entry = -1;
+        for(int k = 0; k < CACHE_ENTRIES; k++) {
+            const cache_entry *entry = &c->entries[k];
+            if(entry->samples.samples == NULL) {
+                free_entry = k;
+                continue;
+            }
+            used += entry->samples.num_samples * sizeof(double);
+            if(victim < 0 || entry->last_used < c->entries[victim].last_used) victim = k;
+        }
+        if(free_entry >= 0 && used + bytes <= c->memory_budget) {
+            cache_entry *entry = &c->entries[free_entry];
+            entry->key = *key;
+            entry->last_used = c->clock;
+            entry->stats = *stats;
+            sound_copyinit(&entry->samples, samples);
+            return;
+        }
+        sound_delete(&c->entries[victim].samples);
+    }
+}
+
+void cache_init(cache *c, unsigned long long memory_budget, const char *directory,
+                unsigned long long disk_budget) {
+    cache_delete(c);
+    c->memory_budget = memory_budget;
+    c->disk_budget = disk_budget;
+    c->directory[0] = '\0';
+    if(directory != NULL && strlen(directory) < CACHE_PATH)
+        memcpy(c->directory, directory, strlen(directory) + 1);
+}
+
+bool cache_process(cache *c, eqmath_stage_cache *stages, const equalizer *eq, const sound *in,
+                   uint64_t input_hash, sound *out, sound_stats *rendered,
+                   void (*progress_callback)(double)) {
+    // zeroed first, so that the padding hashed into file names is always the same
+    cache_key key;
+    memset(&key, 0, sizeof(key));
+    key.input_hash = input_hash;
+    key.num_samples = in->num_samples;
+    key.eq_hash = eq_hash(eq);
+    key.engine = eqmath_get_engine();
+    key.denormals = eqmath_get_denormals();
+    c->clock++;
+
+    for(int k = 0; k < CACHE_ENTRIES; k++) {
+        cache_entry *entry = &c->entries[k];
+        if(entry->samples.samples != NULL && key_equal(&entry->key, &key)) {
+            entry->last_used = c->clock;
+            *rendered = entry->stats;
+            sound_copyinit(out, &entry->samples); // left empty if out of memory
+            return true;
+        }
+    }
+
+    if(c->directory[0] != '\0' && disk_load(c, &key, out, rendered)) {
+        memory_store(c, &key, out, rendered);
+        return true;
+    }
+
+    if(stages != NULL)
+        eqmath_process_cached(stages, eq, in, out, progress_callback);
+    else
+        eqmath_process(eq, in, out, progress_callback);
+    eqmath_last_stats(rendered);
+    if(out->samples == NULL && in->num_samples > 0) return false; // out of memory; nothing to keep
+
+    memory_store(c, &key, out, rendered);
+    if(c->directory[0] != '\0') disk_store(c, &key, out, rendered);
+    return false;
+}
+
+void cache_delete(cache *c) {
+    if(c == NULL) return;
+    for(int k = 0; k < CACHE_ENTRIES; k++)
+        sound_delete(&c->entries[k].samples);
+    c->clock = 0;
+}
@@ -0,0 +1,123 @@
+/** \file cache.h
+ *  \defgroup cache Render cache module
+ *  \{
+ *  \brief The cache module remembers whole renders, so that rendering the same input again with
+ *         the same settings only costs a copy.
+ *
+ *  Renders are addressed by their content: the key of a render holds a hash of the input samples,
+ *  the equalizer state as hashed by eq_hash(), and the engine and denormal settings of the eqmath
+ *  module, see eqmath_set_engine() and eqmath_set_denormals(). A key thus stays valid across
+ *  reloads of an unchanged file, and never matches once the file or any setting has changed. The
+ *  input is hashed once, by the caller, so that looking a render up does not cost a pass over it.
+ *
+ *  The cache has two tiers, each evicting its least recently used renders first to stay within
+ *  its budget:
+ *    - A memory tier of at most CACHE_ENTRIES renders. Its samples are counted as sound memory,
+ *      so a render is only kept there if sound_memory_allows() it.
+ *    - An optional disk tier, one file per render in a directory which must already exist, plus
+ *      an index file recording the size and last use of each render. The index is read and
+ *      written on every access, without any locking, so the directory must not be used by
+ *      several instances of KayEQ at once.
+ *  A render found on disk is also kept in memory for the following lookups.
+ *
+ *  If given an already initialised cache, cache_init() deallocates the old data before
+ *  proceeding.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_CACHE_H
+#define INCLUDED_CACHE_H
+
+#include <stdint.h>     // uint64_t, int64_t
+#include <stdbool.h>
+
+#include "sound.h"
+#include "eq.h"
+#include "eqmath.h"
+
+#define CACHE_ENTRIES 4         /**< \brief Renders remembered by the memory tier. */
+#define CACHE_PATH 260          /**< \brief Longest path of the disk tier's directory, plus one. */
+#define CACHE_INDEX "index.txt" /**< \brief Name of the index file inside the directory. */
+
+/** \brief Everything a render depends on. */
+typedef struct cache_key {
+    uint64_t input_hash;        /**< \brief Hash of the input samples, see cache_hash_sound(). */
+    int64_t num_samples;
+    uint64_t eq_hash;
+    int engine;                 /**< \brief eqmath_engine of the render. */
+    int denormals;              /**< \brief eqmath_denormals of the render. */
+} cache_key;
+
+/** \brief One render in the memory tier. */
+typedef struct cache_entry {
+    cache_key key;
+    unsigned long long last_used;
+    sound_stats stats;          /**< \brief Statistics of the output, as by eqmath_last_stats(). */
+    sound samples;              /**< \brief Empty if this entry is unused. */
+} cache_entry;
+
+/** \brief Container for both tiers of the cache. */
+typedef struct cache {
+    unsigned long long memory_budget;   /**< \brief Most bytes of samples in the memory tier. */
+    unsigned long long clock;           /**< \brief Incremented on every lookup, for LRU eviction. */
+    cache_entry entries[CACHE_ENTRIES];
+    char directory[CACHE_PATH];         /**< \brief Directory of the disk tier, empty if none. */
+    unsigned long long disk_budget;     /**< \brief Most bytes of files in the disk tier. */
+} cache;
+
+/** \brief Initialises an empty cache, deallocating previous data, if any exists.
+ *
+ *  Renders already in the directory are kept, and evicted as usual as new ones are stored.
+ *
+ *  \param[out] c              Pointer to the cache to initialise.
+ *  \param[in]  memory_budget  Most bytes of samples to keep in memory.
+ *  \param[in]  directory      Existing directory for the disk tier, or NULL or an empty string
+ *                             for none. Paths too long for CACHE_PATH also disable the disk tier.
+ *  \param[in]  disk_budget    Most bytes of files to keep in the directory.
+ */
+void cache_init(cache *c, unsigned long long memory_budget, const char *directory,
+                unsigned long long disk_budget);
+
+/** \brief Hash the samples of a sound, so that equal signals get equal hashes.
+ *
+ *  This reads every sample, so it is meant to be called once per loaded input, and its result
+ *  passed to every cache_process() on that input.
+ *
+ *  \param[in] snd  Pointer to the sound to hash.
+ *
+ *  \return 64-bit FNV-1a hash of the bytes of the samples, by eq_fnv1a().
+ */
+uint64_t cache_hash_sound(const sound *snd);
+
+/** \brief Same as eqmath_process_cached(), but first looking the render up in the cache, and
+ *         storing it there otherwise.
+ *
+ *  \param[in,out] c                  Pointer to the cache to use.
+ *  \param[in,out] stages             Pointer to the stage cache to render with, or NULL to render
+ *                                    with eqmath_process().
+ *  \param[in]     eq                 Pointer to equalizer to use for processing the signal.
+ *  \param[in]     in                 Pointer to input sound.
+ *  \param[in]     input_hash         Hash of in, as by cache_hash_sound().
+ *  \param[out]    out                Pointer to output sound.
+ *  \param[out]    rendered           Pointer to a sound_stats to receive the statistics of the
+ *                                    output, as by eqmath_last_stats().
+ *  \param[in]     progress_callback  Function to call with the progress of a render. Not called
+ *                                    for a render found in the cache.
+ *
+ *  \return Whether the render was found in the cache.
+ */
+bool cache_process(cache *c, eqmath_stage_cache *stages, const equalizer *eq, const sound *in,
+                   uint64_t input_hash, sound *out, sound_stats *rendered,
+                   void (*progress_callback)(double));
+
+/** \brief Deallocates the memory tier of a cache, leaving it empty. The disk tier is kept.
+ *
+ *  \param[in,out] c  Pointer to the cache to deallocate.
+ */
+void cache_delete(cache *c);
+
+/** \} */
+
+#endif // INCLUDED_CACHE_H
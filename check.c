@@ -0,0 +1,31 @@
+/** \file check.c
+ *  \brief The check file is the entry point of kayeq_check, which runs the accuracy check of every
+ *         rendering variant without the user interface, so that it builds and runs on any
+ *         platform, e.g. in continuous integration.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#include <stdio.h>
+#include <stdlib.h> // atoi
+
+#include "eq.h"
+#include "bench.h"
+
+/** \brief Entry point; runs every check through bench_check_all().
+ *
+ *  Usage: kayeq_check [number of bands]
+ *
+ *  \param[in] argc  Number of command line arguments.
+ *  \param[in] argv  Command line arguments; the optional first one selects a single number of
+ *                   bands instead of each of BENCH_CHECK_BAND_COUNTS.
+ *
+ *  \return 0 if every check passed, 1 otherwise.
+ */
+int main(int argc, char **argv) {
+    int nfreq = argc > 1 ? atoi(argv[1]) : 0;
+    if(nfreq < MINNFREQ || nfreq > MAXNFREQ) nfreq = 0;
+
+    return bench_check_all(stdout, nfreq) ? 0 : 1;
+}
@@ -0,0 +1,465 @@
+#include "convert.h"
+#include <stdint.h>
+#include <string.h> // memcpy
+#include <math.h>   // lrint
+#include <pthread.h> // pthread_once
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+// Divisors mapping integer samples to [-1.0; 1.0]
+#define S16_SCALE 32767.0
+#define S24_SCALE 8388607.0
+#define S32_SCALE 2147483647.0
+
+int convert_bytes(convert_type type) {
+    static const int bytes[CONVERT_TYPES] = { 1, 2, 3, 4, 4, 8 };
+    return bytes[type];
+}
+
+bool convert_type_of(int audio_format, int bits_per_sample, convert_type *type) {
+    if(audio_format == 1 && bits_per_sample == 8) *type = CONVERT_U8;
+    else if(audio_format == 1 && bits_per_sample == 16) *type = CONVERT_S16;
+    else if(audio_format == 1 && bits_per_sample == 24) *type = CONVERT_S24;
+    else if(audio_format == 1 && bits_per_sample == 32) *type = CONVERT_S32;
+    else if(audio_format == 3 && bits_per_sample == 32) *type = CONVERT_F32;
+    else if(audio_format == 3 && bits_per_sample == 64) *type = CONVERT_F64;
+    else return false;
+    return true;
+}
+
+/* ---- plain C kernels; also handle the tails the vector kernels leave over ---- */
+
+// the clamps are written the way MAXPD/MINPD behave, so that NaN ends up at lo like in the
+// vector kernels
+static inline int32_t quantise(double x, double scale, double lo, double hi) {
+    double v = x * scale;
+    v = v > lo ? v : lo;
+    v = v < hi ? v : hi;
+    return (int32_t) lrint(v);
+}
+
+static void i32_to_double(const void *src, double *dst, int n, double scale) {
+    const unsigned char *s = src;
+    for(int i = 0; i < n; i++) {
+        int32_t x;
+        memcpy(&x, s + 4 * i, 4);
+        dst[i] = x / scale;
+    }
+}
+
+static void double_to_i32(const double *src, void *dst, int n, double scale, double lo, double hi) {
+    unsigned char *d = dst;
+    for(int i = 0; i < n; i++) {
+        const int32_t x = quantise(src[i], scale, lo, hi);
+        memcpy(d + 4 * i, &x, 4);
+    }
+}
+
+static void s16_to_double(const void *src, double *dst, int n) {
+    const unsigned char *s = src;
+    for(int i = 0; i < n; i++) {
+        int16_t x;
+        memcpy(&x, s + 2 * i, 2);
+        dst[i] = x / S16_SCALE;
+    }
+}
+
+static void double_to_s16(const double *src, void *dst, int n) {
+    unsigned char *d = dst;
+    for(int i = 0; i < n; i++) {
+        const int16_t x = quantise(src[i], S16_SCALE, -S16_SCALE, S16_SCALE);
+        memcpy(d + 2 * i, &x, 2);
+    }
+}
+
+static void f32_to_double(const void *src, double *dst, int n) {
+    const unsigned char *s = src;
+    for(int i = 0; i < n; i++) {
+        float x;
+        memcpy(&x, s + 4 * i, 4);
+        dst[i] = x;
+    }
+}
+
+static void double_to_f32(const double *src, void *dst, int n) {
+    unsigned char *d = dst;
+    for(int i = 0; i < n; i++) {
+        const float x = src[i];
+        memcpy(d + 4 * i, &x, 4);
+    }
+}
+
+#ifdef CONVERT_X86
+
+/* ---- SSE2: 2 doubles per register ---- */
+
+__attribute__((target("sse2")))
+static void i32_to_double_sse2(const void *src, double *dst, int n, double scale) {
+    const int32_t *s = src;
+    const __m128d divisor = _mm_set1_pd(scale);
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        _mm_storeu_pd(dst + i,     _mm_div_pd(_mm_cvtepi32_pd(v), divisor));
+        _mm_storeu_pd(dst + i + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, 0xee)), divisor));
+    }
+    i32_to_double(s + i, dst + i, n - i, scale);
+}
+
+// scale, clamp and round 2 doubles to 2 int32 in the low half of the register
+__attribute__((target("sse2")))
+static inline __m128i quantise_sse2(const double *src, __m128d scale, __m128d lo, __m128d hi) {
+    const __m128d x = _mm_mul_pd(_mm_loadu_pd(src), scale);
+    return _mm_cvtpd_epi32(_mm_min_pd(_mm_max_pd(x, lo), hi));
+}
+
+__attribute__((target("sse2")))
+static void double_to_i32_sse2(const double *src, void *dst, int n, double scale, double lo, double hi) {
+    int32_t *d = dst;
+    const __m128d vscale = _mm_set1_pd(scale), vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi);
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const __m128i v = _mm_unpacklo_epi64(quantise_sse2(src + i, vscale, vlo, vhi),
+                                             quantise_sse2(src + i + 2, vscale, vlo, vhi));
+        _mm_storeu_si128((__m128i *) (d + i), v);
+    }
+    double_to_i32(src + i, d + i, n - i, scale, lo, hi);
+}
+
+__attribute__((target("sse2")))
+static void s16_to_double_sse2(const void *src, double *dst, int n) {
+    const int16_t *s = src;
+    const __m128d divisor = _mm_set1_pd(S16_SCALE);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        // sign-extend by placing each sample in the top half of an int32 and shifting it down
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_pd(dst + i,     _mm_div_pd(_mm_cvtepi32_pd(lo), divisor));
+        _mm_storeu_pd(dst + i + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(lo, 0xee)), divisor));
+        _mm_storeu_pd(dst + i + 4, _mm_div_pd(_mm_cvtepi32_pd(hi), divisor));
+        _mm_storeu_pd(dst + i + 6, _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(hi, 0xee)), divisor));
+    }
+    s16_to_double(s + i, dst + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void double_to_s16_sse2(const double *src, void *dst, int n) {
+    int16_t *d = dst;
+    const __m128d scale = _mm_set1_pd(S16_SCALE), lo = _mm_set1_pd(-S16_SCALE);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_unpacklo_epi64(quantise_sse2(src + i, scale, lo, scale),
+                                             quantise_sse2(src + i + 2, scale, lo, scale));
+        const __m128i b = _mm_unpacklo_epi64(quantise_sse2(src + i + 4, scale, lo, scale),
+                                             quantise_sse2(src + i + 6, scale, lo, scale));
+        _mm_storeu_si128((__m128i *) (d + i), _mm_packs_epi32(a, b));
+    }
+    double_to_s16(src + i, d + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void f32_to_double_sse2(const void *src, double *dst, int n) {
+    const float *s = src;
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_loadu_ps(s + i);
+        _mm_storeu_pd(dst + i,     _mm_cvtps_pd(v));
+        _mm_storeu_pd(dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    f32_to_double(s + i, dst + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void double_to_f32_sse2(const double *src, void *dst, int n) {
+    float *d = dst;
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+        const __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+        _mm_storeu_ps(d + i, _mm_movelh_ps(lo, hi));
+    }
+    double_to_f32(src + i, d + i, n - i);
+}
+
+/* ---- AVX2: 4 doubles per register ---- */
+
+__attribute__((target("avx2")))
+static void i32_to_double_avx2(const void *src, double *dst, int n, double scale) {
+    const int32_t *s = src;
+    const __m256d divisor = _mm256_set1_pd(scale);
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        _mm256_storeu_pd(dst + i, _mm256_div_pd(_mm256_cvtepi32_pd(v), divisor));
+    }
+    i32_to_double(s + i, dst + i, n - i, scale);
+}
+
+// scale, clamp and round 4 doubles to 4 int32
+__attribute__((target("avx2")))
+static inline __m128i quantise_avx2(const double *src, __m256d scale, __m256d lo, __m256d hi) {
+    const __m256d x = _mm256_mul_pd(_mm256_loadu_pd(src), scale);
+    return _mm256_cvtpd_epi32(_mm256_min_pd(_mm256_max_pd(x, lo), hi));
+}
+
+__attribute__((target("avx2")))
+static void double_to_i32_avx2(const double *src, void *dst, int n, double scale, double lo, double hi) {
+    int32_t *d = dst;
+    const __m256d vscale = _mm256_set1_pd(scale), vlo = _mm256_set1_pd(lo), vhi = _mm256_set1_pd(hi);
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *) (d + i), quantise_avx2(src + i, vscale, vlo, vhi));
+    double_to_i32(src + i, d + i, n - i, scale, lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_double_avx2(const void *src, double *dst, int n) {
+    const int16_t *s = src;
+    const __m256d divisor = _mm256_set1_pd(S16_SCALE);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (s + i)));
+        _mm256_storeu_pd(dst + i,     _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), divisor));
+        _mm256_storeu_pd(dst + i + 4, _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), divisor));
+    }
+    s16_to_double(s + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void double_to_s16_avx2(const double *src, void *dst, int n) {
+    int16_t *d = dst;
+    const __m256d scale = _mm256_set1_pd(S16_SCALE), lo = _mm256_set1_pd(-S16_SCALE);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i packed = _mm_packs_epi32(quantise_avx2(src + i, scale, lo, scale),
+                                               quantise_avx2(src + i + 4, scale, lo, scale));
+        _mm_storeu_si128((__m128i *) (d + i), packed);
+    }
+    double_to_s16(src + i, d + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void f32_to_double_avx2(const void *src, double *dst, int n) {
+    const float *s = src;
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(s + i)));
+    f32_to_double(s + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void double_to_f32_avx2(const double *src, void *dst, int n) {
+    float *d = dst;
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+        _mm_storeu_ps(d + i, _mm256_cvtpd_ps(_mm256_loadu_pd(src + i)));
+    double_to_f32(src + i, d + i, n - i);
+}
+
+/* ---- AVX-512: 8 doubles per register ---- */
+
+__attribute__((target("avx512f")))
+static void i32_to_double_avx512(const void *src, double *dst, int n, double scale) {
+    const int32_t *s = src;
+    const __m512d divisor = _mm512_set1_pd(scale);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        _mm512_storeu_pd(dst + i, _mm512_div_pd(_mm512_cvtepi32_pd(v), divisor));
+    }
+    i32_to_double(s + i, dst + i, n - i, scale);
+}
+
+// scale, clamp and round 8 doubles to 8 int32
+__attribute__((target("avx512f")))
+static inline __m256i quantise_avx512(const double *src, __m512d scale, __m512d lo, __m512d hi) {
+    const __m512d x = _mm512_mul_pd(_mm512_loadu_pd(src), scale);
+    return _mm512_cvtpd_epi32(_mm512_min_pd(_mm512_max_pd(x, lo), hi));
+}
+
+__attribute__((target("avx512f")))
+static void double_to_i32_avx512(const double *src, void *dst, int n, double scale, double lo, double hi) {
+    int32_t *d = dst;
+    const __m512d vscale = _mm512_set1_pd(scale), vlo = _mm512_set1_pd(lo), vhi = _mm512_set1_pd(hi);
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *) (d + i), quantise_avx512(src + i, vscale, vlo, vhi));
+    double_to_i32(src + i, d + i, n - i, scale, lo, hi);
+}
+
+__attribute__((target("avx512f")))
+static void s16_to_double_avx512(const void *src, double *dst, int n) {
+    const int16_t *s = src;
+    const __m512d divisor = _mm512_set1_pd(S16_SCALE);
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *) (s + i)));
+        _mm512_storeu_pd(dst + i,     _mm512_div_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(v)), divisor));
+        _mm512_storeu_pd(dst + i + 8, _mm512_div_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v, 1)), divisor));
+    }
+    s16_to_double(s + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void double_to_s16_avx512(const double *src, void *dst, int n) {
+    int16_t *d = dst;
+    const __m512d scale = _mm512_set1_pd(S16_SCALE), lo = _mm512_set1_pd(-S16_SCALE);
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m512i both = _mm512_inserti64x4(_mm512_castsi256_si512(quantise_avx512(src + i, scale, lo, scale)),
+                                                quantise_avx512(src + i + 8, scale, lo, scale), 1);
+        _mm256_storeu_si256((__m256i *) (d + i), _mm512_cvtsepi32_epi16(both));
+    }
+    double_to_s16(src + i, d + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void f32_to_double_avx512(const void *src, double *dst, int n) {
+    const float *s = src;
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm512_storeu_pd(dst + i, _mm512_cvtps_pd(_mm256_loadu_ps(s + i)));
+    f32_to_double(s + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void double_to_f32_avx512(const double *src, void *dst, int n) {
+    float *d = dst;
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(d + i, _mm512_cvtpd_ps(_mm512_loadu_pd(src + i)));
+    double_to_f32(src + i, d + i, n - i);
+}
+
+#endif // CONVERT_X86
+
+/* ---- dispatch ---- */
+
+typedef struct kernels {
+    void (*i32_to_double)(const void *src, double *dst, int n, double scale);
+    void (*double_to_i32)(const double *src, void *dst, int n, double scale, double lo, double hi);
+    void (*s16_to_double)(const void *src, double *dst, int n);
+    void (*double_to_s16)(const double *src, void *dst, int n);
+    void (*f32_to_double)(const void *src, double *dst, int n);
+    void (*double_to_f32)(const double *src, void *dst, int n);
+} kernels;
+
+static const kernels isa_kernels[] = {
+    [CONVERT_SCALAR] = { i32_to_double, double_to_i32, s16_to_double, double_to_s16,
+                         f32_to_double, double_to_f32 },
+#ifdef CONVERT_X86
+    [CONVERT_SSE2]   = { i32_to_double_sse2, double_to_i32_sse2, s16_to_double_sse2, double_to_s16_sse2,
+                         f32_to_double_sse2, double_to_f32_sse2 },
+    [CONVERT_AVX2]   = { i32_to_double_avx2, double_to_i32_avx2, s16_to_double_avx2, double_to_s16_avx2,
+                         f32_to_double_avx2, double_to_f32_avx2 },
+    [CONVERT_AVX512] = { i32_to_double_avx512, double_to_i32_avx512, s16_to_double_avx512, double_to_s16_avx512,
+                         f32_to_double_avx512, double_to_f32_avx512 },
+#endif
+};
+
+static const kernels *current = NULL;
+static convert_isa current_isa = CONVERT_SCALAR;
+static pthread_once_t chosen = PTHREAD_ONCE_INIT;
+
+convert_isa convert_best_isa(void) {
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return CONVERT_AVX512;
+    if(__builtin_cpu_supports("avx2")) return CONVERT_AVX2;
+    if(__builtin_cpu_supports("sse2")) return CONVERT_SSE2;
+#endif
+    return CONVERT_SCALAR;
+}
+
+// Picks the best kernels; run once, before the first conversion or choice of kernels, even if
+// the reader and writer threads of a render both convert first.
+static void choose_best(void) {
+    current_isa = convert_best_isa();
+    current = &isa_kernels[current_isa];
+}
+
+void convert_use_isa(convert_isa isa) {
+    pthread_once(&chosen, choose_best);
+    const convert_isa best = convert_best_isa();
+    if(isa > best) isa = best;
+
+    current = &isa_kernels[isa];
+    current_isa = isa;
+}
+
+convert_isa convert_current_isa(void) {
+    pthread_once(&chosen, choose_best);
+    return current_isa;
+}
+
+// 8 and 24 bit samples are widened to int32 a block at a time and go through the int32 kernels
+#define STAGE_BLOCK 1024
+
+void convert_to_double(convert_type type, const void *src, double *dst, int n) {
+    pthread_once(&chosen, choose_best);
+
+    const unsigned char *s = src;
+    int32_t staged[STAGE_BLOCK];
+
+    switch(type) {
+    case CONVERT_U8:
+    case CONVERT_S24:
+        for(int start = 0; start < n; start += STAGE_BLOCK) {
+            const int count = n - start < STAGE_BLOCK ? n - start : STAGE_BLOCK;
+            const unsigned char *block = s + (size_t) start * convert_bytes(type);
+            if(type == CONVERT_U8) {
+                for(int i = 0; i < count; i++) staged[i] = block[i] - 128;
+            } else {
+                // assemble in the top bytes so the arithmetic shift sign-extends
+                for(int i = 0; i < count; i++)
+                    staged[i] = (int32_t) ((uint32_t) block[3*i] << 8 | (uint32_t) block[3*i+1] << 16 |
+                                           (uint32_t) block[3*i+2] << 24) >> 8;
+            }
+            current->i32_to_double(staged, dst + start, count, type == CONVERT_U8 ? 128.0 : S24_SCALE);
+        }
+        break;
+    case CONVERT_S16: current->s16_to_double(src, dst, n); break;
+    case CONVERT_S32: current->i32_to_double(src, dst, n, S32_SCALE); break;
+    case CONVERT_F32: current->f32_to_double(src, dst, n); break;
+    case CONVERT_F64: memcpy(dst, src, n * sizeof(double)); break;
+    default: break;
+    }
+}
+
+void convert_from_double(convert_type type, const double *src, void *dst, int n) {
+    pthread_once(&chosen, choose_best);
+
+    unsigned char *d = dst;
+    int32_t staged[STAGE_BLOCK];
+
+    switch(type) {
+    case CONVERT_U8:
+    case CONVERT_S24:
+        for(int start = 0; start < n; start += STAGE_BLOCK) {
+            const int count = n - start < STAGE_BLOCK ? n - start : STAGE_BLOCK;
+            unsigned char *block = d + (size_t) start * convert_bytes(type);
+            if(type == CONVERT_U8) {
+                current->double_to_i32(src + start, staged, count, 128.0, -128.0, 127.0);
+                for(int i = 0; i < count; i++) block[i] = staged[i] + 128;
+            } else {
+                current->double_to_i32(src + start, staged, count, S24_SCALE, -S24_SCALE, S24_SCALE);
+                for(int i = 0; i < count; i++) {
+                    block[3*i]   = staged[i];
+                    block[3*i+1] = staged[i] >> 8;
+                    block[3*i+2] = staged[i] >> 16;
+                }
+            }
+        }
+        break;
+    case CONVERT_S16: current->double_to_s16(src, dst, n); break;
+    case CONVERT_S32: current->double_to_i32(src, dst, n, S32_SCALE, -S32_SCALE, S32_SCALE); break;
+    case CONVERT_F32: current->double_to_f32(src, dst, n); break;
+    case CONVERT_F64: memcpy(dst, src, n * sizeof(double)); break;
+    default: break;
+    }
+}
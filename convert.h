@@ -0,0 +1,94 @@
+/** \file convert.h
+ *  \defgroup convert Sample conversion module
+ *  \{
+ *  \brief The convert module translates between the sample formats found in WAV files and the
+ *         doubles used for processing, in both directions.
+ *
+ *  Integer samples map to [-1.0; 1.0] by dividing by the largest positive value of their type
+ *  (8-bit samples are unsigned, centered on 128). Converting back multiplies by the same value,
+ *  clamps to the range of the type and rounds to the nearest integer.
+ *
+ *  There are vectorised kernels for SSE2, AVX2 and AVX-512; 8 and 24-bit samples are widened to
+ *  32 bits first and share the 32-bit kernels. The best set of kernels the CPU supports is picked
+ *  exactly once, the first time a conversion runs, falling back to plain C on other architectures;
+ *  conversions may thus start on several threads at once. All kernels give exactly the same
+ *  results as the plain C ones.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_CONVERT_H
+#define INCLUDED_CONVERT_H
+
+#include <stdbool.h>
+
+/** \brief Sample formats of WAV files. */
+typedef enum convert_type {
+    CONVERT_U8,     /**< \brief 8-bit unsigned PCM. */
+    CONVERT_S16,    /**< \brief 16-bit signed PCM. */
+    CONVERT_S24,    /**< \brief 24-bit signed PCM, packed in 3 bytes. */
+    CONVERT_S32,    /**< \brief 32-bit signed PCM. */
+    CONVERT_F32,    /**< \brief 32-bit IEEE float. */
+    CONVERT_F64,    /**< \brief 64-bit IEEE float. */
+    CONVERT_TYPES   /**< \brief Number of formats; not a format. */
+} convert_type;
+
+/** \brief Instruction sets the kernels are written for, from slowest to fastest. */
+typedef enum convert_isa {
+    CONVERT_SCALAR,
+    CONVERT_SSE2,
+    CONVERT_AVX2,
+    CONVERT_AVX512
+} convert_isa;
+
+/** \brief Size of one sample of the given format, in bytes.
+ *
+ *  \param[in] type  Sample format.
+ */
+int convert_bytes(convert_type type);
+
+/** \brief Find the sample format of a WAV format chunk.
+ *
+ *  \param[in]  audio_format     1 for PCM, 3 for float.
+ *  \param[in]  bits_per_sample  Bits per sample.
+ *  \param[out] type             Pointer to receive the sample format.
+ *
+ *  \return Whether the format is supported.
+ */
+bool convert_type_of(int audio_format, int bits_per_sample, convert_type *type);
+
+/** \brief Most capable instruction set supported by the CPU. */
+convert_isa convert_best_isa(void);
+
+/** \brief Restrict the kernels to a given instruction set, e.g. to compare them. Not to be called
+ *         while conversions are running.
+ *
+ *  \param[in] isa  Instruction set to use. Clamped to convert_best_isa().
+ */
+void convert_use_isa(convert_isa isa);
+
+/** \brief Instruction set of the kernels currently in use. */
+convert_isa convert_current_isa(void);
+
+/** \brief Convert samples of the given format to doubles.
+ *
+ *  \param[in]  type  Format of the source samples.
+ *  \param[in]  src   Source samples; need not be aligned.
+ *  \param[out] dst   Array of n doubles to receive the converted samples.
+ *  \param[in]  n     Number of samples.
+ */
+void convert_to_double(convert_type type, const void *src, double *dst, int n);
+
+/** \brief Convert doubles to samples of the given format, clamping and rounding as needed.
+ *
+ *  \param[in]  type  Format of the destination samples.
+ *  \param[in]  src   Array of n doubles to convert.
+ *  \param[out] dst   Buffer of n * convert_bytes(type) bytes; need not be aligned.
+ *  \param[in]  n     Number of samples.
+ */
+void convert_from_double(convert_type type, const double *src, void *dst, int n);
+
+/** \} */
+
+#endif // INCLUDED_CONVERT_H
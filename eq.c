@@ -1,14 +1,72 @@
 #include "eq.h"
-#include <math.h> // pow
+#include <math.h>   // pow
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcpy, memcmp
 
 const double eq_q_values[10] = {0.5, 0.7, 1.0, 1.3, 1.8, 2.5, 3.4, 4.7, 6.5, 9.0};
 
-void eq_init(equalizer *eq) {
-    for(int i = 0; i < NFREQ; i++) {
+void eq_init(equalizer *eq, int nfreq) {
+    eq_delete(eq);
+    eq->nfreq = nfreq;
+    eq->gain_db = calloc(nfreq, sizeof(double));
+    eq->q_idx = calloc(nfreq, sizeof(uint8_t));
+    eq->freqs = calloc(nfreq, sizeof(double));
+
+    for(int i = 0; i < nfreq; i++) {
         eq->gain_db[i] = 0.0;
         eq->q_idx[i] = 4;
-        eq->freqs[i] = LOFREQ * pow(1.0 * HIFREQ / LOFREQ, 1.0 * i / (NFREQ - 1));
+        eq->freqs[i] = LOFREQ * pow(1.0 * HIFREQ / LOFREQ, 1.0 * i / (nfreq - 1));
+    }
+}
+
+void eq_delete(equalizer *eq) {
+    if(eq == NULL) return;
+    eq->nfreq = 0;
+    free(eq->gain_db);
+    free(eq->q_idx);
+    free(eq->freqs);
+    eq->gain_db = NULL;
+    eq->q_idx = NULL;
+    eq->freqs = NULL;
+}
+
+int eq_active_bands(const equalizer *eq, int *active) {
+    int n = 0;
+    for(int i = 0; i < eq->nfreq; i++)
+        if(eq->gain_db[i] != 0.0) active[n++] = i;
+    return n;
+}
+
+uint64_t eq_fnv1a(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
     }
+    return hash;
+}
+
+void eq_copyinit(equalizer *dst, const equalizer *src) {
+    eq_init(dst, src->nfreq);
+    memcpy(dst->gain_db, src->gain_db, src->nfreq * sizeof(double));
+    memcpy(dst->q_idx, src->q_idx, src->nfreq * sizeof(uint8_t));
+    memcpy(dst->freqs, src->freqs, src->nfreq * sizeof(double));
+}
+
+bool eq_equal(const equalizer *a, const equalizer *b) {
+    return a->nfreq == b->nfreq &&
+           memcmp(a->gain_db, b->gain_db, a->nfreq * sizeof(double)) == 0 &&
+           memcmp(a->q_idx, b->q_idx, a->nfreq * sizeof(uint8_t)) == 0 &&
+           memcmp(a->freqs, b->freqs, a->nfreq * sizeof(double)) == 0;
+}
+
+uint64_t eq_hash(const equalizer *eq) {
+    uint64_t hash = EQ_FNV1A_BASIS;
+    hash = eq_fnv1a(hash, &eq->nfreq, sizeof(eq->nfreq));
+    hash = eq_fnv1a(hash, eq->freqs, eq->nfreq * sizeof(double));
+    hash = eq_fnv1a(hash, eq->gain_db, eq->nfreq * sizeof(double));
+    hash = eq_fnv1a(hash, eq->q_idx, eq->nfreq * sizeof(uint8_t));
+    return hash;
 }
 
 void eq_set_q_option(equalizer *eq, int cursor_pos, int q_opt) {
@@ -5,7 +5,10 @@
  *
  *  An equalizer has a number of control points equally spaced on a logarithmic frequency scale.
  *  Each control point is identified by its index, has a unique frequency, and an adjustable gain
- *  and Q factor.
+ *  and Q factor. The number of control points is chosen when the equalizer is initialised.
+ *
+ *  Bands left at 0dB are inactive: their filter is the identity, so the processing functions skip
+ *  them and the cost of rendering scales with the number of bands actually in use.
  *
  *  Coupled to the user interface, the Q factor can only take one of 10 values.
  *
@@ -18,14 +21,20 @@
 #ifndef INCLUDED_EQ_H
 #define INCLUDED_EQ_H
 
-#include <stdint.h> // uint8_t
+#include <stdint.h>  // uint8_t, uint64_t
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
 
-#define NFREQ 75        /**< \brief Number of controllable frequencies/filters. */
+#define NFREQ 75        /**< \brief Default number of controllable frequencies/filters. */
+#define MINNFREQ 2      /**< \brief Lowest number of frequencies an equalizer can have. */
+#define MAXNFREQ 1024   /**< \brief Highest number of frequencies an equalizer can have. */
 #define LOFREQ 20       /**< \brief Lowest controllable frequency. */
 #define HIFREQ 20000    /**< \brief Highest controllable frequency. */
 #define LOGAIN -20.0    /**< \brief Lowest gain the user can set for a filter, in decibels. */
 #define HIGAIN 20.0     /**< \brief Highest gain the user can set for a filter, in decibels. */
 
+#define EQ_FNV1A_BASIS 0xcbf29ce484222325ull   /**< \brief Starting value of an eq_fnv1a() hash. */
+
 /** \brief The numeric values of the 10 options for the Q factor.
  *
  *  C's handling of this is quite freaky and it prevents us from declaring the 10 values here, so we
@@ -34,24 +43,80 @@
 extern const double eq_q_values[10];
 
 /** \brief Equalizer state stores the gain in decibels, Q factor index, and center frequency for
- *         each of the NFREQ filters.
+ *         each of the nfreq filters, as one dynamically allocated array per parameter.
  */
 typedef struct equalizer {
-    double gain_db[NFREQ];
-    uint8_t q_idx[NFREQ];
-    double freqs[NFREQ];
+    int nfreq;
+    double *gain_db;
+    uint8_t *q_idx;
+    double *freqs;
 } equalizer;
 
-/** \brief Initialise an equalizer state to a default Q = 1.8, gain = 0dB for all frequencies.
+/** \brief Initialise an equalizer state to a default Q = 1.8, gain = 0dB for all frequencies,
+ *         deallocating previous data, if any exists.
+ *
+ *  \param[in,out] eq     Pointer to the equalizer to initialise.
+ *  \param[in]     nfreq  Number of frequencies. [MINNFREQ; MAXNFREQ]
+ */
+void eq_init(equalizer *eq, int nfreq);
+
+/** \brief Deallocates an equalizer.
+ *
+ *  \param[in,out] eq  Pointer to the equalizer to deallocate.
+ */
+void eq_delete(equalizer *eq);
+
+/** \brief Copy-initialises an equalizer with the state of another, deallocating previous data, if
+ *         any exists.
+ *
+ *  \param[out] dst  Pointer to the equalizer to initialise.
+ *  \param[in]  src  Pointer to the equalizer to copy.
+ */
+void eq_copyinit(equalizer *dst, const equalizer *src);
+
+/** \brief Compare the whole state of two equalizers.
+ *
+ *  \param[in] a  Pointer to an equalizer.
+ *  \param[in] b  Pointer to another equalizer.
+ *
+ *  \return Whether both have the same frequencies, gains and Q factors.
+ */
+bool eq_equal(const equalizer *a, const equalizer *b);
+
+/** \brief List the filters which actually change the sound, i.e. have a non-zero gain.
+ *
+ *  \param[in]  eq      Pointer to the equalizer to inspect.
+ *  \param[out] active  Array of at least eq->nfreq ints to receive the active indices, in order.
+ *
+ *  \return Number of active filters.
+ */
+int eq_active_bands(const equalizer *eq, int *active);
+
+/** \brief Continue a 64-bit FNV-1a hash over a block of bytes.
+ *
+ *  Every hash of the program goes through this, so that settings, samples and cache keys are hashed
+ *  the same way.
+ *
+ *  \param[in] hash  Hash of the bytes so far, EQ_FNV1A_BASIS for none.
+ *  \param[in] data  Bytes to hash.
+ *  \param[in] size  Number of bytes.
+ *
+ *  \return Hash of the bytes so far followed by data.
+ */
+uint64_t eq_fnv1a(uint64_t hash, const void *data, size_t size);
+
+/** \brief Hash the whole state of an equalizer, so that equal states get equal hashes.
+ *
+ *  \param[in] eq  Pointer to the equalizer to hash.
  *
- *  \param[in,out] eq  Pointer to the equalizer to initialise.
+ *  \return 64-bit FNV-1a hash of the frequencies, gains and Q factors.
  */
-void eq_init(equalizer *eq);
+uint64_t eq_hash(const equalizer *eq);
 
 /** \brief Control the Q factor of a given filter.
  *
  *  \param[in,out] eq        Pointer to the equalizer to change.
- *  \param[in]     freq_idx  Index of selected frequency. [0; NFREQ-1]
+ *  \param[in]     freq_idx  Index of selected frequency. [0; nfreq-1]
  *  \param[in]     q_idx     Index of Q factor value to apply. [0; 9]
  */
 void eq_set_q_option(equalizer *eq, int freq_idx, int q_idx);
@@ -59,7 +124,7 @@ void eq_set_q_option(equalizer *eq, int freq_idx, int q_idx);
 /** \brief Change the gain of a given filter by a relative amount, clamping to [LOGAIN; HIGAIN].
  *
  *  \param[in,out] eq             Pointer to the equalizer to change.
- *  \param[in]     freq_idx       Index of selected frequency. [0; NFREQ-1]
+ *  \param[in]     freq_idx       Index of selected frequency. [0; nfreq-1]
  *  \param[in]     gain_db_delta  Amount to increase the gain of this frequency, in decibels.
  */
 void eq_change_gain(equalizer *eq, int freq_idx, double gain_db_delta);
@@ -1,23 +1,111 @@
 #include "eqmath.h"
-#include <math.h>    // cos, sin, log10, pow
-#include <complex.h> // complex, cexpf, cabs
+#include <math.h>    // cos, sin, log, log10, pow, fabs, INFINITY
+#include <complex.h> // complex, cexpf, cexp, csqrt, cabs
+#include <stdlib.h>  // malloc, realloc, free
+#include <string.h>  // memcpy, memcmp
+#include <limits.h>  // INT_MAX
 #include <assert.h>
+#include <float.h>   // DBL_MIN
+
+#ifdef __SSE2_MATH__
+#include <xmmintrin.h> // _mm_getcsr, _mm_setcsr
+#endif
 
 #define PI 3.14159265358979323846
 
-static double memo_cos[NFREQ] = { 0.0 };
-static double memo_alpha[10][NFREQ] = {{ 0.0 }};
+static eqmath_engine engine = EQMATH_SERIAL;
+static eqmath_denormals denormals = EQMATH_DENORMALS_FLUSH;
+static sound_stats last_stats = { 0 };
+
+static double *memo_cos = NULL;
+static double *memo_alpha[10] = { NULL };
+static double complex *memo_z = NULL;   // z^-1 at each band's frequency
+
+// Amplitude 10^(gain/40) of a peaking EQ at each whole decibel of [LOGAIN; HIGAIN], the steps the
+// gains are edited in. Together with memo_alpha and memo_cos, a filter at such a gain is prepared
+// from table reads alone.
+#define GAIN_STEPS ((int) (HIGAIN - LOGAIN) + 1)
+static double *memo_amplitude = NULL;
 
 void eqmath_init(equalizer *eq) {
-    for(int i = 0; i < NFREQ; i++) {
+    memo_amplitude = realloc(memo_amplitude, GAIN_STEPS * sizeof(double));
+    for(int k = 0; k < GAIN_STEPS; k++)
+        memo_amplitude[k] = pow(10, (LOGAIN + k) / 40);
+
+    memo_cos = realloc(memo_cos, eq->nfreq * sizeof(double));
+    memo_z = realloc(memo_z, eq->nfreq * sizeof(double complex));
+    for(int j = 0; j < 10; j++)
+        memo_alpha[j] = realloc(memo_alpha[j], eq->nfreq * sizeof(double));
+
+    for(int i = 0; i < eq->nfreq; i++) {
         const double w0 = 2 * PI * eq->freqs[i] / SAMPLERATE;
         memo_cos[i] = cos(w0);
+        memo_z[i] = cexpf(-2 * I * PI * eq->freqs[i] / SAMPLERATE);
         for(int j = 0; j < 10; j++) {
             memo_alpha[j][i] = sin(w0) / (2 * eq_q_values[j]);
         }
     }
 }
 
+void eqmath_set_engine(eqmath_engine new_engine) {
+    engine = new_engine;
+}
+
+eqmath_engine eqmath_get_engine(void) {
+    return engine;
+}
+
+void eqmath_set_denormals(eqmath_denormals mode) {
+    denormals = mode;
+}
+
+eqmath_denormals eqmath_get_denormals(void) {
+    return denormals;
+}
+
+#ifdef __SSE2_MATH__
+
+// MXCSR flush-to-zero and denormals-are-zero bits
+#define MXCSR_FTZ_DAZ 0x8040
+
+// Enter the chosen denormal mode for the duration of a filter, returning what to restore after.
+static unsigned denormals_begin(void) {
+    const unsigned saved = _mm_getcsr();
+    if(denormals == EQMATH_DENORMALS_FLUSH) _mm_setcsr(saved | MXCSR_FTZ_DAZ);
+    else _mm_setcsr(saved & ~MXCSR_FTZ_DAZ);
+    return saved;
+}
+
+static void denormals_end(unsigned saved) {
+    _mm_setcsr(saved);
+}
+
+// the hardware already did it
+static inline double flush_denormal(double v) {
+    return v;
+}
+
+#else
+
+static unsigned denormals_begin(void) {
+    return 0;
+}
+
+static void denormals_end(unsigned saved) {
+    (void) saved;
+}
+
+// without control over the FPU, at least keep subnormal values from lingering in the state
+static inline double flush_denormal(double v) {
+    return denormals == EQMATH_DENORMALS_FLUSH && fabs(v) < DBL_MIN ? 0.0 : v;
+}
+
+#endif
+
+void eqmath_last_stats(sound_stats *stats) {
+    *stats = last_stats;
+}
+
 double eqmath_gain_to_db(double gain) {
     return log10(gain) * 20;
 }
@@ -26,32 +114,58 @@ double eqmath_db_to_gain(double db) {
     return pow(10.0, db / 20.0);
 }
 
-void eqmath_one_frequency_response(const equalizer *eq, double gain[NFREQ], int cursor) {
+void eqmath_one_frequency_response(const equalizer *eq, double *gain, int cursor) {
     biquad filter = { 0 };
     eqmath_biquad_prepare_peakingeq(&filter, eq, cursor);
-    for(int i = 0; i < NFREQ; i++) {
+    for(int i = 0; i < eq->nfreq; i++) {
         // z is actually z^-1 from the formulas
-        const double complex z = cexpf(-2 * I * PI * eq->freqs[i] / SAMPLERATE);
+        const double complex z = memo_z[i];
         const double complex H = (filter.b0 + filter.b1 * z + filter.b2 * z * z) /
                                  (filter.a0 + filter.a1 * z + filter.a2 * z * z);
         gain[i] = cabs(H);
     }
 }
 
-void eqmath_overall_frequency_response(const equalizer *eq, double out[NFREQ]) {
-    for(int i = 0; i < NFREQ; i++) out[i] = 1.0;
-    for(int i = 0; i < NFREQ; i++) {
-        double partial_gain[NFREQ] = { 0 };
-        eqmath_one_frequency_response(eq, partial_gain, i);
-        for(int j = 0; j < NFREQ; j++) out[j] *= partial_gain[j];
+void eqmath_overall_frequency_response(const equalizer *eq, double *out) {
+    const int n = eq->nfreq;
+    int *active = malloc(n * sizeof(int));
+    double *partial_gain = malloc(n * sizeof(double));
+
+    // inactive filters have a flat response of 1.0
+    for(int i = 0; i < n; i++) out[i] = 1.0;
+    const int nactive = eq_active_bands(eq, active);
+    for(int k = 0; k < nactive; k++) {
+        eqmath_one_frequency_response(eq, partial_gain, active[k]);
+        for(int j = 0; j < n; j++) out[j] *= partial_gain[j];
     }
+
+    free(active);
+    free(partial_gain);
 }
 
 // http://shepazu.github.io/Audio-EQ-Cookbook/audio-eq-cookbook.html
+// 10^(gain_db/40), read from memo_amplitude at whole decibels and interpolated between them by the
+// cubic Hermite spline through the neighbouring steps and their exact slopes, within 3e-8 of it.
+static double amplitude(double gain_db) {
+    const double position = gain_db - LOGAIN;
+    if(!(position >= 0 && position <= HIGAIN - LOGAIN) || memo_amplitude == NULL)
+        return pow(10, gain_db / 40);
+
+    const int k = (int) position;
+    const double t = position - k;
+    if(t == 0.0) return memo_amplitude[k];
+
+    const double slope = log(10) / 40;  // of ln(A) per decibel
+    const double a0 = memo_amplitude[k], a1 = memo_amplitude[k + 1];
+    const double t2 = t * t, t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * a0 + (t3 - 2 * t2 + t) * slope * a0
+         + (3 * t2 - 2 * t3) * a1 + (t3 - t2) * slope * a1;
+}
+
 void eqmath_biquad_prepare_peakingeq(biquad *filter, const equalizer *eq, int i) {
     const double alpha = memo_alpha[eq->q_idx[i]][i];
     const double c = memo_cos[i];
-    const double A = pow(10, eq->gain_db[i] / 40);
+    const double A = amplitude(eq->gain_db[i]);
 
     filter->b0 = 1 + alpha * A;
     filter->b1 = -2 * c;
@@ -61,45 +175,713 @@ void eqmath_biquad_prepare_peakingeq(biquad *filter, const equalizer *eq, int i)
     filter->a2 = 1 - alpha / A;
 }
 
+void eqmath_biquad_run(const biquad *filter, biquad_state *state, const double *x, double *y, int64_t n) {
+    const unsigned csr = denormals_begin();
+    double x1 = state->x1, x2 = state->x2, y1 = state->y1, y2 = state->y2;
+
+    for(int64_t i = 0; i < n; i++) {
+        const double x0 = x[i];
+        const double y0 = (filter->b0 * x0 + filter->b1 * x1 + filter->b2 * x2 - filter->a1 * y1 - filter->a2 * y2) / filter->a0;
+        x2 = x1; x1 = x0;
+        y2 = y1; y1 = y0;
+        y[i] = y0;
+    }
+
+    state->x1 = flush_denormal(x1); state->x2 = flush_denormal(x2);
+    state->y1 = flush_denormal(y1); state->y2 = flush_denormal(y2);
+    denormals_end(csr);
+}
+
 void eqmath_biquad_apply(const biquad *filter, const sound *in, sound *out) {
     assert(in->num_samples == out->num_samples);
 
-    double *x = in->samples;
-    double *y = out->samples;
+    biquad_state state = { 0 };
+    eqmath_biquad_run(filter, &state, in->samples, out->samples, in->num_samples);
+}
+
+// Cascade kernels, generated for every number of sections up to EQMATH_CASCADE_WIDTH. The
+// sections are unrolled with their coefficients and state in local variables, and each evaluates
+// the same expression as eqmath_biquad_run().
+#define CASCADE_REPEAT_1(M) M(0)
+#define CASCADE_REPEAT_2(M) CASCADE_REPEAT_1(M) M(1)
+#define CASCADE_REPEAT_3(M) CASCADE_REPEAT_2(M) M(2)
+#define CASCADE_REPEAT_4(M) CASCADE_REPEAT_3(M) M(3)
+
+#define CASCADE_LOAD(k) \
+    const double b0_##k = f[k].b0, b1_##k = f[k].b1, b2_##k = f[k].b2; \
+    const double a0_##k = f[k].a0, a1_##k = f[k].a1, a2_##k = f[k].a2; \
+    double x1_##k = s[k].x1, x2_##k = s[k].x2, y1_##k = s[k].y1, y2_##k = s[k].y2;
+
+#define CASCADE_STEP(k) { \
+    const double y0 = (b0_##k * v + b1_##k * x1_##k + b2_##k * x2_##k - a1_##k * y1_##k - a2_##k * y2_##k) / a0_##k; \
+    x2_##k = x1_##k; x1_##k = v; \
+    y2_##k = y1_##k; y1_##k = y0; \
+    v = y0; \
+}
+
+#define CASCADE_STORE(k) \
+    s[k].x1 = flush_denormal(x1_##k); s[k].x2 = flush_denormal(x2_##k); \
+    s[k].y1 = flush_denormal(y1_##k); s[k].y2 = flush_denormal(y2_##k);
+
+#define CASCADE_KERNEL(n) \
+static void cascade_##n(const biquad *f, biquad_state *s, double *x, int64_t len) { \
+    CASCADE_REPEAT_##n(CASCADE_LOAD) \
+    for(int64_t i = 0; i < len; i++) { \
+        double v = x[i]; \
+        CASCADE_REPEAT_##n(CASCADE_STEP) \
+        x[i] = v; \
+    } \
+    CASCADE_REPEAT_##n(CASCADE_STORE) \
+}
+
+CASCADE_KERNEL(1) CASCADE_KERNEL(2) CASCADE_KERNEL(3) CASCADE_KERNEL(4)
+
+static void (*const cascade_kernels[EQMATH_CASCADE_WIDTH + 1])(const biquad *, biquad_state *, double *, int64_t) = {
+    NULL, cascade_1, cascade_2, cascade_3, cascade_4
+};
+
+// Samples per chunk run through all passes of a cascade, small enough to stay in the L1 cache.
+#define CASCADE_CHUNK 1024
+
+void eqmath_cascade_run(const biquad *filters, biquad_state *states, int nfilters, double *x, int64_t n) {
+    const unsigned csr = denormals_begin();
+    for(int64_t start = 0; start < n; start += CASCADE_CHUNK) {
+        const int64_t len = n - start < CASCADE_CHUNK ? n - start : CASCADE_CHUNK;
+        for(int k = 0; k < nfilters; k += EQMATH_CASCADE_WIDTH) {
+            const int width = nfilters - k < EQMATH_CASCADE_WIDTH ? nfilters - k : EQMATH_CASCADE_WIDTH;
+            cascade_kernels[width](filters + k, states + k, x + start, len);
+        }
+    }
+    denormals_end(csr);
+}
+
+// Parallel form by partial fraction expansion. With w = z^-1, each active section m is
+//   H_m(w) = (b0 + b1 w + b2 w^2) / (a0 (1 - p w)(1 - p' w)),
+// and the cascade of all of them is
+//   H(w) = D + sum over poles p_j of r_j / (1 - p_j w),
+// where D = H(w -> inf) = prod(b2 / a2) and r_j = [(1 - p_j w) H(w)] at w = 1 / p_j. The two
+// terms of the poles of a section are merged back into a real second-order section.
+bool eqmath_parallel_prepare(eqmath_parallel *bank, const equalizer *eq) {
+    eqmath_parallel_delete(bank);
+
+    int *active = malloc(eq->nfreq * sizeof(int));
+    const int nactive = eq_active_bands(eq, active);
+    biquad *filters = malloc(nactive * sizeof(biquad));
+    double complex *poles = malloc(2 * nactive * sizeof(double complex));
+    bool ok = true;
+
+    bank->direct = 1.0;
+    for(int k = 0; k < nactive; k++) {
+        eqmath_biquad_prepare_peakingeq(&filters[k], eq, active[k]);
+        const biquad *f = &filters[k];
+        if(fabs(f->a2 / f->a0) < 1e-12) ok = false; // pole at the origin
+
+        const double complex d = csqrt(f->a1 * f->a1 - 4 * f->a0 * f->a2);
+        poles[2*k]   = (-f->a1 + d) / (2 * f->a0);
+        poles[2*k+1] = (-f->a1 - d) / (2 * f->a0);
+        bank->direct *= f->b2 / f->a2;
+    }
+
+    const int padded = (nactive + EQMATH_PARALLEL_LANES - 1) / EQMATH_PARALLEL_LANES
+                     * EQMATH_PARALLEL_LANES;
+    double *coefs = calloc(4 * padded, sizeof(double));
+    bank->nsections = padded;
+    bank->b0 = coefs;
+    bank->b1 = coefs + padded;
+    bank->a1 = coefs + 2 * padded;
+    bank->a2 = coefs + 3 * padded;
+
+    for(int m = 0; ok && m < nactive; m++) {
+        double complex r[2];
+        for(int j = 0; j < 2; j++) {
+            const double complex p = poles[2*m+j], other = poles[2*m+1-j];
+            if(cabs(p - other) < 1e-12) ok = false; // repeated pole
+
+            const double complex w = 1.0 / p;
+            double complex acc = 1.0;
+            for(int k = 0; k < nactive; k++) {
+                const biquad *f = &filters[k];
+                const double complex num = (f->b0 + f->b1 * w + f->b2 * w * w) / f->a0;
+                if(k == m) acc *= num / (1.0 - other * w);
+                else acc *= num / ((f->a0 + f->a1 * w + f->a2 * w * w) / f->a0);
+            }
+            r[j] = acc;
+        }
+
+        bank->b0[m] = creal(r[0] + r[1]);
+        bank->b1[m] = -creal(r[0] * poles[2*m+1] + r[1] * poles[2*m]);
+        bank->a1[m] = -creal(poles[2*m] + poles[2*m+1]);
+        bank->a2[m] = creal(poles[2*m] * poles[2*m+1]);
+    }
+
+    free(active);
+    free(filters);
+    free(poles);
 
-    y[0] = (filter->b0 * x[0] + filter->b1 * 0    + filter->b2 * 0 - filter->a1 * 0    - filter->a2 * 0) / filter->a0;
-    y[1] = (filter->b0 * x[1] + filter->b1 * x[0] + filter->b2 * 0 - filter->a1 * y[0] - filter->a2 * 0) / filter->a0;
+    if(!ok || !isfinite(bank->direct)) {
+        eqmath_parallel_delete(bank);
+        return false;
+    }
+    return true;
+}
+
+double eqmath_parallel_error_db(const eqmath_parallel *bank, const equalizer *eq) {
+    const int GRID = 512;
+    int *active = malloc(eq->nfreq * sizeof(int));
+    const int nactive = eq_active_bands(eq, active);
+    biquad *filters = malloc(nactive * sizeof(biquad));
+    for(int k = 0; k < nactive; k++)
+        eqmath_biquad_prepare_peakingeq(&filters[k], eq, active[k]);
+
+    double max_error = 0.0;
+    for(int i = 0; i < GRID; i++) {
+        const double freq = LOFREQ / 2.0 * pow(SAMPLERATE / 1.0 / LOFREQ, 1.0 * i / GRID);
+        const double complex z = cexp(-2 * I * PI * freq / SAMPLERATE);
+
+        double complex serial = 1.0, parallel = bank->direct;
+        for(int k = 0; k < nactive; k++)
+            serial *= (filters[k].b0 + filters[k].b1 * z + filters[k].b2 * z * z) /
+                      (filters[k].a0 + filters[k].a1 * z + filters[k].a2 * z * z);
+        for(int k = 0; k < bank->nsections; k++)
+            parallel += (bank->b0[k] + bank->b1[k] * z) /
+                        (1.0 + bank->a1[k] * z + bank->a2[k] * z * z);
+
+        const double error = fabs(eqmath_gain_to_db(cabs(parallel) / cabs(serial)));
+        if(!(error <= max_error)) max_error = error; // also propagates NaN
+    }
 
-    for(int n = 2; n < in->num_samples; n++) {
-        y[n] = (filter->b0 * x[n] + filter->b1 * x[n-1] + filter->b2 * x[n-2] - filter->a1 * y[n-1] - filter->a2 * y[n-2]) / filter->a0;
+    free(active);
+    free(filters);
+    return max_error;
+}
+
+void eqmath_parallel_run(const eqmath_parallel *bank, double *state, const double *x, double *y, int64_t n) {
+    const unsigned csr = denormals_begin();
+    double *s1 = state, *s2 = state + bank->nsections;
+
+    // transposed direct form 2; the sections of one group of lanes share no data, so the inner
+    // loop maps onto vector instructions
+    for(int64_t i = 0; i < n; i++) {
+        const double x0 = x[i];
+        double lane_sum[EQMATH_PARALLEL_LANES] = { 0.0 };
+
+        for(int k = 0; k < bank->nsections; k += EQMATH_PARALLEL_LANES) {
+            for(int l = 0; l < EQMATH_PARALLEL_LANES; l++) {
+                const double yk = bank->b0[k+l] * x0 + s1[k+l];
+                s1[k+l] = bank->b1[k+l] * x0 - bank->a1[k+l] * yk + s2[k+l];
+                s2[k+l] = -bank->a2[k+l] * yk;
+                lane_sum[l] += yk;
+            }
+        }
+
+        double sum = bank->direct * x0;
+        for(int l = 0; l < EQMATH_PARALLEL_LANES; l++) sum += lane_sum[l];
+        y[i] = sum;
     }
+
+    for(int k = 0; k < bank->nsections; k++) {
+        s1[k] = flush_denormal(s1[k]);
+        s2[k] = flush_denormal(s2[k]);
+    }
+    denormals_end(csr);
+}
+
+void eqmath_parallel_delete(eqmath_parallel *bank) {
+    if(bank == NULL) return;
+    free(bank->b0); // all coefficients share one allocation
+    const eqmath_parallel empty = { 0 };
+    *bank = empty;
+}
+
+// Prepare the parallel form if the parallel engine is selected and the expansion is accurate.
+static bool use_parallel(eqmath_parallel *bank, const equalizer *eq) {
+    if(engine != EQMATH_PARALLEL) return false;
+    if(!eqmath_parallel_prepare(bank, eq)) return false;
+    if(eqmath_parallel_error_db(bank, eq) <= EQMATH_PARALLEL_TOLERANCE_DB) return true;
+    eqmath_parallel_delete(bank);
+    return false;
+}
+
+// samples per block for block-wise processing; small enough to stay in L1/L2
+#define MAP_BLOCK 4096
+
+// Apply the last filter of a render block by block, gathering the output statistics while each
+// block is still in cache.
+static void apply_last_stage(const biquad *filter, const sound *in, sound *out) {
+    biquad_state state = { 0 };
+    for(int64_t start = 0; start < in->num_samples; start += MAP_BLOCK) {
+        const int n = in->num_samples - start < MAP_BLOCK ? in->num_samples - start : MAP_BLOCK;
+        eqmath_biquad_run(filter, &state, in->samples + start, out->samples + start, n);
+        sound_stats_update(&last_stats, out->samples + start, n);
+    }
+}
+
+static void process_parallel(const eqmath_parallel *bank, const sound *in, sound *out, void (*progress_callback)(double)) {
+    if(!sound_copyinit(out, in)) return;
+    double *state = calloc(2 * bank->nsections, sizeof(double));
+
+    progress_callback(0.0);
+    for(int64_t start = 0; start < in->num_samples; start += MAP_BLOCK) {
+        const int n = in->num_samples - start < MAP_BLOCK ? in->num_samples - start : MAP_BLOCK;
+        eqmath_parallel_run(bank, state, out->samples + start, out->samples + start, n);
+        sound_stats_update(&last_stats, out->samples + start, n);
+        progress_callback(1.0 * (start + n) / in->num_samples);
+    }
+
+    free(state);
+}
+
+// Run the samples [position; position + n) of a signal through a stream in place, then move
+// their output back by the stream's latency, to where it belongs in out. The input there has
+// already been read. Output which would land before the start of out is dropped.
+static void run_aligned(eqmath_stream *stream, double *block, int n, int64_t position, double *out) {
+    eqmath_stream_run(stream, block, n);
+
+    const int latency = eqmath_stream_latency(stream);
+    const int skip = position >= latency ? 0 : latency - position < n ? latency - position : n;
+    memmove(out + position + skip - latency, block + skip, (n - skip) * sizeof(double));
+    sound_stats_update(&last_stats, out + position + skip - latency, n - skip);
+}
+
+// Run zeros through a stream after the end of its num_samples long input, for the last of its
+// output which its latency still held back.
+static void flush_aligned(eqmath_stream *stream, double *out, int64_t num_samples) {
+    double *zeros = malloc(MAP_BLOCK * sizeof(double));
+    const int latency = eqmath_stream_latency(stream);
+    for(int64_t start = num_samples; start < num_samples + latency; start += MAP_BLOCK) {
+        const int n = num_samples + latency - start < MAP_BLOCK ? num_samples + latency - start : MAP_BLOCK;
+        for(int i = 0; i < n; i++) zeros[i] = 0.0;
+        run_aligned(stream, zeros, n, start, out);
+    }
+    free(zeros);
+}
+
+// The whole cascade over one block at a time, in place in the output: needs no signal-length
+// buffer besides the output, at the cost of reporting progress per block instead of per filter.
+static void process_streamed(const equalizer *eq, const sound *in, sound *out, void (*progress_callback)(double)) {
+    if(!sound_copyinit(out, in)) return;
+    eqmath_stream stream = { 0 };
+    eqmath_stream_init(&stream, eq);
+
+    progress_callback(0.0);
+    for(int64_t start = 0; start < in->num_samples; start += MAP_BLOCK) {
+        const int n = in->num_samples - start < MAP_BLOCK ? in->num_samples - start : MAP_BLOCK;
+        run_aligned(&stream, out->samples + start, n, start, out->samples);
+        progress_callback(1.0 * (start + n) / in->num_samples);
+    }
+    flush_aligned(&stream, out->samples, in->num_samples);
+
+    eqmath_stream_delete(&stream);
 }
 
 void eqmath_process(const equalizer *eq, const sound *in, sound *out, void (*progress_callback)(double)) {
+    sound_stats_reset(&last_stats);
+    sound_delete(out); // the previous output is not needed while rendering the new one
+
+    // the linear-phase filter only exists as a stream, whose output is put back in line
+    if(engine == EQMATH_LINEAR_PHASE) {
+        process_streamed(eq, in, out, progress_callback);
+        return;
+    }
+
+    eqmath_parallel bank = { 0 };
+    if(use_parallel(&bank, eq)) {
+        process_parallel(&bank, in, out, progress_callback);
+        eqmath_parallel_delete(&bank);
+        return;
+    }
+
+    // one filter at a time needs two signal-length buffers
+    if(!sound_memory_allows(2 * in->num_samples * sizeof(double))) {
+        process_streamed(eq, in, out, progress_callback);
+        return;
+    }
+
     sound intermediate1 = { 0 }, intermediate2 = { 0 };
     sound *intermediate_in = &intermediate1, *intermediate_out = &intermediate2;
-    sound_copyinit(intermediate_in, in);
-    sound_init(intermediate_out, in->num_samples);
+    if(!sound_copyinit(intermediate_in, in) || !sound_init(intermediate_out, in->num_samples)) {
+        // the limit allowed both buffers but the system did not, so make do with one
+        sound_delete(intermediate_in);
+        sound_delete(intermediate_out);
+        process_streamed(eq, in, out, progress_callback);
+        return;
+    }
+
+    int *active = malloc(eq->nfreq * sizeof(int));
+    const int nactive = eq_active_bands(eq, active);
 
     progress_callback(0.0);
 
-    // apply each filter "in series"
-    for(int i = 0; i < NFREQ; i++) {
+    // apply each active filter "in series"
+    for(int k = 0; k < nactive; k++) {
         biquad filter;
-        eqmath_biquad_prepare_peakingeq(&filter, eq, i);
-        eqmath_biquad_apply(&filter, intermediate_in, intermediate_out);
+        eqmath_biquad_prepare_peakingeq(&filter, eq, active[k]);
+        if(k == nactive - 1) apply_last_stage(&filter, intermediate_in, intermediate_out);
+        else eqmath_biquad_apply(&filter, intermediate_in, intermediate_out);
 
         sound *tmp = intermediate_in;
         intermediate_in = intermediate_out;
         intermediate_out = tmp;
 
-        progress_callback(i * 1.0 / (NFREQ-1));
+        progress_callback((k + 1) * 1.0 / nactive);
     }
 
-    // copy last intermediate result to output
-    sound_copyinit(out, intermediate_in);
+    free(active);
+    if(nactive == 0) sound_stats_update(&last_stats, intermediate_in->samples, in->num_samples);
 
-    // clean up
-    sound_delete(intermediate_in);
+    // the last intermediate result becomes the output
+    *out = *intermediate_in;
+    intermediate_in->samples = NULL;
+    intermediate_in->num_samples = 0;
     sound_delete(intermediate_out);
 }
+
+static void ignore_progress(double progress) {
+    (void) progress;
+}
+
+double eqmath_engine_error(const equalizer *eq, eqmath_engine tested, const sound *in) {
+    const eqmath_engine selected = engine;
+    sound reference = { 0 }, candidate = { 0 };
+
+    engine = EQMATH_SERIAL;
+    eqmath_process(eq, in, &reference, ignore_progress);
+    engine = tested;
+    eqmath_process(eq, in, &candidate, ignore_progress);
+    engine = selected;
+
+    // a render which could not be allocated is as wrong as it gets
+    double max_error = reference.samples != NULL && candidate.samples != NULL ? 0.0 : INFINITY;
+    for(int64_t i = 0; i < in->num_samples && max_error < INFINITY; i++) {
+        const double error = fabs(reference.samples[i] - candidate.samples[i]);
+        if(!(error <= max_error)) max_error = error;
+    }
+
+    sound_delete(&reference);
+    sound_delete(&candidate);
+    return max_error;
+}
+
+void eqmath_process_map(const equalizer *eq, const sound_map *in, sound *out, void (*progress_callback)(double)) {
+    sound_stats_reset(&last_stats);
+    if(!sound_init(out, sound_resampled_length(in->num_samples, in->sample_rate))) return;
+
+    eqmath_stream stream = { 0 };
+    eqmath_stream_init(&stream, eq);
+
+    sound_resampler resampler;
+    sound_resampler_init(&resampler, in->sample_rate);
+    double *decoded = in->sample_rate == SAMPLERATE ? NULL : malloc(MAP_BLOCK * sizeof(double));
+
+    progress_callback(0.0);
+
+    // run the whole cascade over one block at a time, in place in the output buffer
+    int64_t produced = 0;
+    for(int64_t start = 0; start < in->num_samples; start += MAP_BLOCK) {
+        const int n = in->num_samples - start < MAP_BLOCK ? in->num_samples - start : MAP_BLOCK;
+        double *block = out->samples + produced;
+
+        int64_t m = n;
+        if(decoded == NULL) {
+            sound_map_read(in, start, n, block);
+        } else {
+            sound_map_read(in, start, n, decoded);
+            m = sound_resampler_run(&resampler, decoded, n, start + n == in->num_samples, block);
+        }
+        run_aligned(&stream, block, m, produced, out->samples);
+        produced += m;
+
+        progress_callback(1.0 * (start + n) / in->num_samples);
+    }
+    flush_aligned(&stream, out->samples, produced);
+
+    free(decoded);
+    eqmath_stream_delete(&stream);
+}
+
+// Linear-phase FIR filter with the magnitude response of the equalizer's cascade, sampled on the
+// frequency grid of fir_design().
+static void design_linear_phase(const equalizer *eq, double *h) {
+    const int bins = FIR_SIZE / 2 + 1;
+    double *magnitude = malloc(bins * sizeof(double));
+    double complex *z = malloc(bins * sizeof(double complex));
+    for(int k = 0; k < bins; k++) {
+        magnitude[k] = 1.0;
+        z[k] = cexp(-2 * I * PI * k / FIR_SIZE);
+    }
+
+    int *active = malloc(eq->nfreq * sizeof(int));
+    const int nactive = eq_active_bands(eq, active);
+    for(int j = 0; j < nactive; j++) {
+        biquad f;
+        eqmath_biquad_prepare_peakingeq(&f, eq, active[j]);
+        for(int k = 0; k < bins; k++)
+            magnitude[k] *= cabs((f.b0 + f.b1 * z[k] + f.b2 * z[k] * z[k]) /
+                                 (f.a0 + f.a1 * z[k] + f.a2 * z[k] * z[k]));
+    }
+
+    fir_design(magnitude, h);
+    free(active);
+    free(z);
+    free(magnitude);
+}
+
+void eqmath_stream_init(eqmath_stream *stream, const equalizer *eq) {
+    eqmath_stream_delete(stream);
+
+    if(engine == EQMATH_LINEAR_PHASE) {
+        double *h = malloc(FIR_TAPS * sizeof(double));
+        design_linear_phase(eq, h);
+        fir_convolver_init(&stream->fir, h, FIR_TAPS);
+        free(h);
+    }
+
+    const bool parallel = use_parallel(&stream->bank, eq);
+    stream->bank_state = calloc(2 * stream->bank.nsections, sizeof(double));
+
+    int *active = malloc(eq->nfreq * sizeof(int));
+    stream->nactive = parallel || engine == EQMATH_LINEAR_PHASE ? 0 : eq_active_bands(eq, active);
+    stream->filters = malloc(eq->nfreq * sizeof(biquad));
+    stream->states = calloc(eq->nfreq, sizeof(biquad_state));
+    for(int k = 0; k < stream->nactive; k++)
+        eqmath_biquad_prepare_peakingeq(&stream->filters[k], eq, active[k]);
+    free(active);
+}
+
+void eqmath_stream_run(eqmath_stream *stream, double *x, int64_t n) {
+    if(stream->fir.partitions > 0) fir_convolver_run(&stream->fir, x, n);
+    if(stream->bank.nsections > 0) eqmath_parallel_run(&stream->bank, stream->bank_state, x, x, n);
+    eqmath_cascade_run(stream->filters, stream->states, stream->nactive, x, n);
+}
+
+int eqmath_stream_latency(const eqmath_stream *stream) {
+    return stream->fir.partitions > 0 ? FIR_TAPS / 2 + FIR_BLOCK : 0;
+}
+
+void eqmath_stream_delete(eqmath_stream *stream) {
+    eqmath_parallel_delete(&stream->bank);
+    fir_convolver_delete(&stream->fir);
+    free(stream->bank_state);
+    free(stream->filters);
+    free(stream->states);
+
+    const eqmath_stream empty = { 0 };
+    *stream = empty;
+}
+
+void eqmath_stage_cache_init(eqmath_stage_cache *cache, unsigned long long budget) {
+    const eqmath_stage_cache empty = { 0 };
+    *cache = empty;
+    cache->budget = budget;
+}
+
+void eqmath_stage_cache_invalidate(eqmath_stage_cache *cache) {
+    const unsigned long long budget = cache->budget;
+    eqmath_stage_cache_delete(cache);
+    eqmath_stage_cache_init(cache, budget);
+}
+
+void eqmath_stage_cache_delete(eqmath_stage_cache *cache) {
+    if(cache == NULL) return;
+    for(int j = 0; j < cache->ncheckpoints; j++)
+        sound_delete(&cache->checkpoints[j]);
+    free(cache->filters);
+    free(cache->active);
+    free(cache->stage);
+    free(cache->valid);
+    free(cache->checkpoints);
+    eqmath_stage_cache_init(cache, 0);
+}
+
+// Set up empty checkpoints for a new input, spread evenly over the bands.
+static void stage_cache_reset(eqmath_stage_cache *cache, const equalizer *eq, const sound *in) {
+    eqmath_stage_cache_invalidate(cache);
+    cache->input = in;
+    cache->num_samples = in->num_samples;
+    cache->nfreq = eq->nfreq;
+    cache->filters = calloc(eq->nfreq, sizeof(biquad));
+    cache->active = calloc(eq->nfreq, sizeof(bool));
+
+    const unsigned long long checkpoint_bytes = (unsigned long long) in->num_samples * sizeof(double);
+    unsigned long long fit = checkpoint_bytes == 0 ? 0 : cache->budget / checkpoint_bytes;
+    if(fit > (unsigned long long) eq->nfreq - 1) fit = eq->nfreq - 1;
+
+    cache->ncheckpoints = fit;
+    cache->stage = malloc(fit * sizeof(int));
+    cache->valid = calloc(fit, sizeof(bool));
+    cache->checkpoints = calloc(fit, sizeof(sound));
+    for(int j = 0; j < cache->ncheckpoints; j++)
+        cache->stage[j] = (j + 1) * eq->nfreq / (cache->ncheckpoints + 1);
+}
+
+void eqmath_process_cached(eqmath_stage_cache *cache, const equalizer *eq, const sound *in, sound *out, void (*progress_callback)(double)) {
+    sound_delete(out);
+    if(engine != EQMATH_SERIAL || !sound_memory_allows(2 * in->num_samples * sizeof(double))) {
+        eqmath_process(eq, in, out, progress_callback);
+        return;
+    }
+
+    bool fresh = false;
+    if(cache->input != in || cache->num_samples != in->num_samples || cache->nfreq != eq->nfreq) {
+        stage_cache_reset(cache, eq, in);
+        fresh = true;
+    }
+
+    // find the first band whose filter changed since the last render
+    int first_changed = fresh ? 0 : eq->nfreq;
+    for(int i = eq->nfreq - 1; i >= 0; i--) {
+        biquad filter = { 0 };
+        const bool active = eq->gain_db[i] != 0.0;
+        if(active) eqmath_biquad_prepare_peakingeq(&filter, eq, i);
+        if(active != cache->active[i] || memcmp(&filter, &cache->filters[i], sizeof(filter)) != 0)
+            first_changed = i;
+        cache->filters[i] = filter;
+        cache->active[i] = active;
+    }
+
+    // resume from the last checkpoint before the change, dropping the ones after it
+    int resume = -1;
+    for(int j = 0; j < cache->ncheckpoints; j++) {
+        if(cache->stage[j] > first_changed) cache->valid[j] = false;
+        if(cache->valid[j]) resume = j;
+    }
+
+    sound current = { 0 }, next = { 0 };
+    sound_delete(out);
+    if(!sound_copyinit(&current, resume < 0 ? in : &cache->checkpoints[resume]) ||
+            !sound_init(&next, in->num_samples)) {
+        sound_delete(&current);
+        return;
+    }
+
+    const int first_stage = resume < 0 ? 0 : cache->stage[resume];
+    int j = resume + 1;
+
+    int last_active = -1;
+    for(int i = first_stage; i < eq->nfreq; i++)
+        if(cache->active[i]) last_active = i;
+
+    sound_stats_reset(&last_stats);
+    if(last_active < 0) sound_stats_update(&last_stats, current.samples, current.num_samples);
+
+    progress_callback(0.0);
+
+    for(int i = first_stage; i < eq->nfreq; i++) {
+        if(cache->active[i]) {
+            if(i == last_active) apply_last_stage(&cache->filters[i], &current, &next);
+            else eqmath_biquad_apply(&cache->filters[i], &current, &next);
+
+            const sound tmp = current;
+            current = next;
+            next = tmp;
+        }
+
+        if(j < cache->ncheckpoints && cache->stage[j] == i + 1) {
+            cache->valid[j] = sound_copyinit(&cache->checkpoints[j], &current);
+            j++;
+        }
+
+        progress_callback((i + 1.0 - first_stage) / (eq->nfreq - first_stage));
+    }
+
+    sound_delete(out);
+    *out = current;
+    sound_delete(&next);
+}
+
+int eqmath_preroll(const equalizer *eq) {
+    if(engine == EQMATH_LINEAR_PHASE) return FIR_TAPS / 2;
+
+    double slowest = 0.0;
+    for(int i = 0; i < eq->nfreq; i++) {
+        if(eq->gain_db[i] == 0.0) continue;
+        biquad f;
+        eqmath_biquad_prepare_peakingeq(&f, eq, i);
+
+        // largest pole radius: |p|^2 = a2 / a0 for complex poles, the larger root for real ones
+        const double a1 = f.a1 / f.a0, a2 = f.a2 / f.a0;
+        const double disc = a1 * a1 - 4 * a2;
+        const double radius = disc < 0 ? sqrt(a2) : (fabs(a1) + sqrt(disc)) / 2;
+        if(radius > slowest) slowest = radius;
+    }
+
+    if(slowest <= 0.0) return 0;
+    if(slowest >= 1.0) return INT_MAX; // unstable or marginally stable; never settles
+    return (int) ceil(log(EQMATH_PREROLL_TOLERANCE) / log(slowest));
+}
+
+void eqmath_process_range(const equalizer *eq, const sound *in, int64_t start, int64_t end, sound *out) {
+    const int preroll = eqmath_preroll(eq);
+    const int64_t from = start > preroll ? start - preroll : 0;
+
+    // the linear-phase filter also looks as far ahead as it looks back
+    const int lookahead = engine == EQMATH_LINEAR_PHASE ? preroll : 0;
+    const int64_t to = in->num_samples - end > lookahead ? end + lookahead : in->num_samples;
+
+    sound window = { 0 }, rendered = { 0 };
+    sound_stats_reset(&last_stats);
+    sound_delete(out);
+    if(sound_init(&window, to - from)) {
+        memcpy(window.samples, in->samples + from, (to - from) * sizeof(double));
+        eqmath_process(eq, &window, &rendered, ignore_progress);
+    }
+
+    if(rendered.samples != NULL && sound_init(out, end - start)) {
+        memcpy(out->samples, rendered.samples + (start - from), (end - start) * sizeof(double));
+        sound_stats_reset(&last_stats);
+        sound_stats_update(&last_stats, out->samples, out->num_samples);
+    }
+
+    sound_delete(&window);
+    sound_delete(&rendered);
+}
+
+void eqmath_preview_cache_init(eqmath_preview_cache *cache) {
+    const eqmath_preview_cache empty = { 0 };
+    *cache = empty;
+}
+
+void eqmath_preview_cache_delete(eqmath_preview_cache *cache) {
+    if(cache == NULL) return;
+    for(int k = 0; k < EQMATH_PREVIEW_ENTRIES; k++) {
+        sound_delete(&cache->entries[k].samples);
+        eq_delete(&cache->entries[k].eq);
+    }
+    eqmath_preview_cache_init(cache);
+}
+
+void eqmath_preview(eqmath_preview_cache *cache, const equalizer *eq, const sound *in,
+                    unsigned long long generation, int64_t start, int64_t end, sound *out) {
+    if(cache->input_generation != generation) {
+        eqmath_preview_cache_delete(cache);
+        cache->input_generation = generation;
+    }
+
+    const uint64_t hash = eq_hash(eq);
+    cache->clock++;
+
+    int victim = 0;
+    for(int k = 0; k < EQMATH_PREVIEW_ENTRIES; k++) {
+        eqmath_preview_entry *entry = &cache->entries[k];
+        if(entry->samples.samples != NULL && entry->eq_hash == hash && entry->engine == engine &&
+                entry->denormals == denormals && entry->start == start && entry->end == end &&
+                eq_equal(&entry->eq, eq)) {
+            entry->last_used = cache->clock;
+            sound_copyinit(out, &entry->samples);
+            return;
+        }
+        if(entry->last_used < cache->entries[victim].last_used) victim = k;
+    }
+
+    eqmath_process_range(eq, in, start, end, out);
+
+    eqmath_preview_entry *entry = &cache->entries[victim];
+    entry->eq_hash = hash;
+    eq_copyinit(&entry->eq, eq);
+    entry->engine = engine;
+    entry->denormals = denormals;
+    entry->start = start;
+    entry->end = end;
+    entry->last_used = cache->clock;
+    sound_copyinit(&entry->samples, out);
+}
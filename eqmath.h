@@ -14,6 +14,21 @@
  *    3. Efficiently processing an input signal (linear time, linear memory), by use of its
  *       difference equation form. See eqmath_biquad_apply(), eqmath_process().
  *
+ *  Besides the reference cascade, the filters can be evaluated by other engines which compute the
+ *  same transfer function in a different way, see eqmath_set_engine():
+ *    - EQMATH_PARALLEL expands the cascade into partial fractions, i.e. a direct gain plus a sum of
+ *      independent second-order sections all fed by the same input. Since the sections no longer
+ *      depend on each other, they are evaluated side by side, several per SIMD register. Dense
+ *      settings can make the expansion ill-conditioned, so its response is checked against the
+ *      cascade's, and the cascade is used whenever they differ by more than
+ *      EQMATH_PARALLEL_TOLERANCE_DB.
+ *    - EQMATH_LINEAR_PHASE replaces the cascade by a linear-phase FIR filter with the same
+ *      magnitude response, designed and applied by the fir module. It does not distort the phase,
+ *      and its cost does not depend on the number of active bands. The magnitude is resolved to
+ *      under a Hz, so that only bands a few Hz wide miss by a fraction of a dB, and the whole
+ *      response is delayed by FIR_TAPS / 2 samples, which renders of whole signals compensate for
+ *      but streams cannot, see eqmath_stream_latency().
+ *
  *  [Digital biquadratic filters]: https://en.wikipedia.org/wiki/Digital_biquad_filter
  *  [Audio EQ Cookbook]: https://shepazu.github.io/Audio-EQ-Cookbook/audio-eq-cookbook.html
  *
@@ -26,13 +41,118 @@
 
 #include "eq.h"    // equalizer
 #include "sound.h" // sound
+#include "fir.h"   // fir_convolver
+#include <stdbool.h>
+
+/** \brief Largest deviation from the cascade's response, in dB, for which the parallel form is used.
+ */
+#define EQMATH_PARALLEL_TOLERANCE_DB 0.001
+
+/** \brief Ways of evaluating the filters of an equalizer. */
+typedef enum eqmath_engine {
+    EQMATH_SERIAL,      /**< \brief Biquads applied one after the other. This is the reference. */
+    EQMATH_PARALLEL,    /**< \brief Direct gain plus a sum of independent second-order sections. */
+    EQMATH_LINEAR_PHASE /**< \brief Linear-phase FIR of the same magnitude, by FFT convolution. */
+} eqmath_engine;
+
+/** \brief Ways of treating subnormal numbers, which the filters' state decays into on silent or
+ *         fading input and which many CPUs process dozens of times slower than normal numbers.
+ */
+typedef enum eqmath_denormals {
+    EQMATH_DENORMALS_FLUSH, /**< \brief Flush subnormal values to zero. This is the default. */
+    EQMATH_DENORMALS_KEEP   /**< \brief Exact IEEE arithmetic, at whatever speed the CPU allows. */
+} eqmath_denormals;
 
 /** \brief Biquadratic filter represented by its direct form 1 coefficients. */
 typedef struct biquad {
     double a0, a1, a2, b0, b1, b2;
 } biquad;
 
+/** \brief Delay line of a biquad filter, kept between consecutive blocks of the same signal. */
+typedef struct biquad_state {
+    double x1, x2, y1, y2;
+} biquad_state;
+
+/** \brief Parallel form of a cascade of biquads, with the coefficients of its second-order
+ *         sections stored as one array per coefficient, padded to a multiple of
+ *         EQMATH_PARALLEL_LANES sections.
+ *
+ *  Each section is normalised to a0 = 1 and has no z^-2 term in the numerator.
+ */
+typedef struct eqmath_parallel {
+    int nsections;
+    double direct;
+    double *b0, *b1, *a1, *a2;
+} eqmath_parallel;
+
+#define EQMATH_PARALLEL_LANES 4 /**< \brief Sections evaluated side by side. */
+/** \brief Most filters fused by one cascade kernel. Wider passes run out of registers for the
+ *         state of their filters.
+ */
+#define EQMATH_CASCADE_WIDTH 4
+
+/** \brief Filters of an equalizer prepared to run over a signal one block at a time, together
+ *         with their state between blocks.
+ */
+typedef struct eqmath_stream {
+    eqmath_parallel bank;       /**< \brief Parallel form, if in use; otherwise empty. */
+    double *bank_state;
+    int nactive;                /**< \brief Filters of the cascade, if neither other form is used. */
+    biquad *filters;
+    biquad_state *states;
+    fir_convolver fir;          /**< \brief Linear-phase filter, if in use; otherwise empty. */
+} eqmath_stream;
+
+/** \brief Pre-roll rendered before a range is considered settled once the slowest filter has
+ *         decayed to this fraction of its initial response.
+ */
+#define EQMATH_PREROLL_TOLERANCE 1e-6
+
+#define EQMATH_PREVIEW_ENTRIES 8 /**< \brief Ranges remembered by a preview cache. */
+
+/** \brief One range in a preview cache. */
+typedef struct eqmath_preview_entry {
+    uint64_t eq_hash;           /**< \brief eq_hash() of eq, to skip most entries without comparing. */
+    equalizer eq;               /**< \brief Copy of the equalizer state the range was rendered with. */
+    eqmath_engine engine;
+    eqmath_denormals denormals;
+    int64_t start, end;
+    unsigned long long last_used;
+    sound samples;              /**< \brief Empty if this entry is unused. */
+} eqmath_preview_entry;
+
+/** \brief Recently rendered ranges of one input, keyed by equalizer state, engine, denormal mode
+ *         and range, and evicted least recently used first.
+ */
+typedef struct eqmath_preview_cache {
+    unsigned long long input_generation;    /**< \brief Generation of the input the ranges were
+                                                        rendered from, see eqmath_preview(). */
+    unsigned long long clock;   /**< \brief Incremented on every lookup, for LRU eviction. */
+    eqmath_preview_entry entries[EQMATH_PREVIEW_ENTRIES];
+} eqmath_preview_cache;
+
+/** \brief Intermediate outputs of the cascade, kept between renders of the same input so that a
+ *         render after editing few bands only redoes the stages after the first edited one.
+ *
+ *  Checkpoint j holds the signal after the filters of bands [0; stage[j]) were applied. The
+ *  checkpoints are spread evenly over the bands, as many as fit in the memory budget.
+ */
+typedef struct eqmath_stage_cache {
+    unsigned long long budget;  /**< \brief Most bytes of samples to spend on checkpoints. */
+    const sound *input;         /**< \brief Input of the last render, NULL if there was none. */
+    int64_t num_samples;
+    int nfreq;
+    biquad *filters;            /**< \brief Filter of each band at the last render. */
+    bool *active;               /**< \brief Whether each band was active at the last render. */
+    int ncheckpoints;
+    int *stage;
+    bool *valid;
+    sound *checkpoints;
+} eqmath_stage_cache;
+
 /** \brief Precompute expensive values needed for computing frequency responses each frame.
+ *
+ *  Must be called again whenever an equalizer with a different frequency list is used.
  *
  *  \param[out] eq  Pointer to initialised equalizer to get a frequency list from.
  */
@@ -54,22 +174,27 @@ double eqmath_db_to_gain(double db);
  *
  *  \param[in]  eq        Pointer to equalizer object to get a frequency list and filter parameters
  *                        from.
- *  \param[out] gain      Array of doubles to receive the filter's frequency response as linear
- *                        gains.
+ *  \param[out] gain      Array of eq->nfreq doubles to receive the filter's frequency response as
+ *                        linear gains.
  *  \param[in]  freq_idx  Index of the filter to analyse.
  */
-void eqmath_one_frequency_response(const equalizer *eq, double gain[NFREQ], int cursor);
+void eqmath_one_frequency_response(const equalizer *eq, double *gain, int cursor);
 
 /** \brief Compute the frequency response of all filters applied in series.
  *
  *  \param[in]  eq    Pointer to equalizer object to get a frequency list and filter parameters
  *                    from.
- *  \param[out] gain  Array of doubles to receive the equalizer's frequency response as linear
- *                    gains.
+ *  \param[out] gain  Array of eq->nfreq doubles to receive the equalizer's frequency response as
+ *                    linear gains.
  */
-void eqmath_overall_frequency_response(const equalizer *eq, double gain[NFREQ]);
+void eqmath_overall_frequency_response(const equalizer *eq, double *gain);
 
 /** \brief Initialise a biquad filter in a Peaking-EQ configuration.
+ *
+ *  Every value the cookbook formulas need is tabulated by eqmath_init(), for each band, Q option
+ *  and whole decibel of [LOGAIN; HIGAIN], so preparing a filter costs a few table reads and
+ *  multiplications. Gains between whole decibels are interpolated, within 3e-8 relative error of
+ *  the amplitude 10^(gain/40); gains outside of the range are computed exactly.
  *
  *  \param[out] filter    Pointer to biquad struct to initialise.
  *  \param[in]  eq        Equalizer to get filter parameters from.
@@ -85,10 +210,118 @@ void eqmath_biquad_prepare_peakingeq(biquad *filter, const equalizer *eq, int fr
  */
 void eqmath_biquad_apply(const biquad *filter, const sound *in, sound *out);
 
+/** \brief Run a biquad filter over one block of a longer signal, in place if desired.
+ *
+ *  \param[in]     filter  Pointer to biquad filter to apply.
+ *  \param[in,out] state   Pointer to the filter's delay line. Zero it before the first block.
+ *  \param[in]     x       Block of input samples.
+ *  \param[out]    y       Block of output samples. May be the same array as x.
+ *  \param[in]     n       Number of samples in the block.
+ */
+void eqmath_biquad_run(const biquad *filter, biquad_state *state, const double *x, double *y,
+                       int64_t n);
+
+/** \brief Run a cascade of biquad filters over one block of a longer signal, in place.
+ *
+ *  Same as eqmath_biquad_run() for each filter in turn, with bitwise identical results, but the
+ *  filters are fused into passes of up to EQMATH_CASCADE_WIDTH. Each pass runs a kernel generated
+ *  for its exact number of filters, fully unrolled with their coefficients and state in local
+ *  variables, so a sample goes through every filter of the pass before the next one is read.
+ *
+ *  \param[in]     filters   Array of nfilters biquad filters to apply, in order.
+ *  \param[in,out] states    Array of nfilters delay lines. Zero them before the first block.
+ *  \param[in]     nfilters  Number of filters.
+ *  \param[in,out] x         Block of samples, filtered in place.
+ *  \param[in]     n         Number of samples in the block.
+ */
+void eqmath_cascade_run(const biquad *filters, biquad_state *states, int nfilters, double *x,
+                        int64_t n);
+
+/** \brief Choose how eqmath_process(), eqmath_process_map() and streams evaluate the filters.
+ *
+ *  \param[in] engine  Engine to use for all subsequent renders. The default is EQMATH_SERIAL.
+ */
+void eqmath_set_engine(eqmath_engine engine);
+
+/** \brief Get the engine chosen by eqmath_set_engine(). */
+eqmath_engine eqmath_get_engine(void);
+
+/** \brief Choose how the filters treat subnormal numbers.
+ *
+ *  Where doubles are computed with SSE2, EQMATH_DENORMALS_FLUSH sets the flush-to-zero and
+ *  denormals-are-zero modes while a filter runs, restoring the caller's modes afterwards. Elsewhere
+ *  it flushes the filters' state to zero between blocks.
+ *
+ *  \param[in] mode  Mode to use for all subsequent renders.
+ */
+void eqmath_set_denormals(eqmath_denormals mode);
+
+/** \brief Get the mode chosen by eqmath_set_denormals(). */
+eqmath_denormals eqmath_get_denormals(void);
+
+/** \brief Measure how far the output of an engine strays from that of the reference cascade.
+ *
+ *  \param[in] eq      Pointer to equalizer to use for processing the signal.
+ *  \param[in] engine  Engine to compare to EQMATH_SERIAL.
+ *  \param[in] in      Pointer to the test signal.
+ *
+ *  \return Largest absolute difference between the two outputs. Meaningless for
+ *          EQMATH_LINEAR_PHASE, whose phase differs by design.
+ */
+double eqmath_engine_error(const equalizer *eq, eqmath_engine engine, const sound *in);
+
+/** \brief Level statistics of the output of the last render, gathered while it was produced.
+ *
+ *  \param[out] stats  Pointer to receive the statistics.
+ */
+void eqmath_last_stats(sound_stats *stats);
+
+/** \brief Expand the active filters of an equalizer into their parallel form.
+ *
+ *  \param[out] bank  Pointer to the parallel form to initialise, deallocating previous data.
+ *  \param[in]  eq    Pointer to equalizer to get filter parameters from.
+ *
+ *  \return false if the expansion does not exist (coinciding poles or poles at the origin), in
+ *          which case bank is left empty.
+ */
+bool eqmath_parallel_prepare(eqmath_parallel *bank, const equalizer *eq);
+
+/** \brief Compare the response of a parallel form to that of the cascade it was expanded from.
+ *
+ *  \param[in] bank  Pointer to the parallel form.
+ *  \param[in] eq    Pointer to the equalizer it was prepared from.
+ *
+ *  \return Largest difference in magnitude response between the two, in dB, over a dense
+ *          logarithmic grid spanning [LOFREQ / 2; SAMPLERATE / 2).
+ */
+double eqmath_parallel_error_db(const eqmath_parallel *bank, const equalizer *eq);
+
+/** \brief Run a parallel form over one block of a longer signal, in place if desired.
+ *
+ *  \param[in]     bank   Pointer to the parallel form to apply.
+ *  \param[in,out] state  Array of 2 * bank->nsections doubles holding the delay lines of all
+ *                        sections. Zero it before the first block.
+ *  \param[in]     x      Block of input samples.
+ *  \param[out]    y      Block of output samples. May be the same array as x.
+ *  \param[in]     n      Number of samples in the block.
+ */
+void eqmath_parallel_run(const eqmath_parallel *bank, double *state, const double *x, double *y,
+                         int64_t n);
+
+/** \brief Deallocates a parallel form.
+ *
+ *  \param[in,out] bank  Pointer to the parallel form to deallocate.
+ */
+void eqmath_parallel_delete(eqmath_parallel *bank);
+
 /** \brief Apply all filters of an equalizer in series to an input signal. Since this is relatively
  *         slow, a progress callback function is specified, which can be used to notify the user of
  *         the processing progress.
  *
+ *  Inactive filters (see eq_active_bands()) are skipped. The filters are evaluated by the engine
+ *  chosen with eqmath_set_engine(). If the output cannot be allocated, out is left empty; so it is
+ *  by the other functions rendering into a sound below.
+ *
  *  \param[in]  eq                 Pointer to equalizer to use for processing the signal.
  *  \param[in]  in                 Pointer to input signal.
  *  \param[out] out                Pointer to a sound to be initialised with the resulting signal.
@@ -97,6 +330,151 @@ void eqmath_biquad_apply(const biquad *filter, const sound *in, sound *out);
  */
 void eqmath_process(const equalizer *eq, const sound *in, sound *out, void (*progress_callback)(double));
 
+/** \brief Same as eqmath_process(), but reading the input straight from a mapped mono WAV file.
+ *
+ *  The input is decoded block by block while the whole cascade runs over each block, so only the
+ *  output has to be resident. Files at other sample rates are resampled block by block on the
+ *  way, with a sound_resampler.
+ *
+ *  \param[in]  eq                 Pointer to equalizer to use for processing the signal.
+ *  \param[in]  in                 Pointer to mapped input file.
+ *  \param[out] out                Pointer to a sound to be initialised with the resulting signal.
+ *  \param[in]  progress_callback  Same as for eqmath_process().
+ */
+void eqmath_process_map(const equalizer *eq, const sound_map *in, sound *out,
+                        void (*progress_callback)(double));
+
+/** \brief Prepare the filters of an equalizer for block-wise processing, with silent state.
+ *
+ *  The cascade, its parallel form or the linear-phase filter is chosen the same way as by
+ *  eqmath_process_map().
+ *
+ *  \param[out] stream  Pointer to the stream to initialise, deallocating previous data.
+ *  \param[in]  eq      Pointer to equalizer to use for processing the signal.
+ */
+void eqmath_stream_init(eqmath_stream *stream, const equalizer *eq);
+
+/** \brief Filter the next block of a signal in place.
+ *
+ *  \param[in,out] stream  Pointer to an initialised stream.
+ *  \param[in,out] x       Block of samples.
+ *  \param[in]     n       Number of samples in the block.
+ */
+void eqmath_stream_run(eqmath_stream *stream, double *x, int64_t n);
+
+/** \brief Delay of the output of a stream behind its input.
+ *
+ *  Streams of the cascade or its parallel form have none. The linear-phase filter delays its
+ *  output by FIR_TAPS / 2 samples, the centre of its impulse response, plus FIR_BLOCK samples
+ *  gathered before each block can be convolved. Callers which need the output in line with the
+ *  input drop this many samples from its start, and run as many zeros through the stream after
+ *  the end of the input.
+ *
+ *  \param[in] stream  Pointer to an initialised stream.
+ *
+ *  \return Number of samples the output lags the input by.
+ */
+int eqmath_stream_latency(const eqmath_stream *stream);
+
+/** \brief Deallocates a stream.
+ *
+ *  \param[in,out] stream  Pointer to the stream to deallocate.
+ */
+void eqmath_stream_delete(eqmath_stream *stream);
+
+/** \brief Number of samples to render before a range so that the filters' state has settled, i.e.
+ *         so that the silence assumed before the pre-roll no longer matters.
+ *
+ *  \param[in] eq  Pointer to equalizer to get filter parameters from.
+ *
+ *  \return Samples for the slowest decaying active filter to decay to EQMATH_PREROLL_TOLERANCE,
+ *          or half the linear-phase filter with EQMATH_LINEAR_PHASE.
+ */
+int eqmath_preroll(const equalizer *eq);
+
+/** \brief Process only the range [start; end) of an input signal, after a pre-roll of
+ *         eqmath_preroll() samples (or from the start of the input, if that is closer).
+ *
+ *  With EQMATH_LINEAR_PHASE, as many samples after the range are also rendered, since the filter
+ *  responds to them before they arrive.
+ *
+ *  \param[in]  eq     Pointer to equalizer to use for processing the signal.
+ *  \param[in]  in     Pointer to input signal.
+ *  \param[in]  start  First sample of the range. [0; in->num_samples]
+ *  \param[in]  end    Sample after the last one of the range. [start; in->num_samples]
+ *  \param[out] out    Pointer to a sound to be initialised with the end - start processed samples.
+ */
+void eqmath_process_range(const equalizer *eq, const sound *in, int64_t start, int64_t end,
+                          sound *out);
+
+/** \brief Initialise an empty preview cache.
+ *
+ *  \param[out] cache  Pointer to the cache to initialise.
+ */
+void eqmath_preview_cache_init(eqmath_preview_cache *cache);
+
+/** \brief Deallocates all ranges in a preview cache.
+ *
+ *  \param[in,out] cache  Pointer to the cache to clear.
+ */
+void eqmath_preview_cache_delete(eqmath_preview_cache *cache);
+
+/** \brief Same as eqmath_process_range(), but first looking the range up in a cache, and storing it
+ *         there after rendering it.
+ *
+ *  A range is only taken from the cache if the whole equalizer state it was rendered with equals
+ *  eq, not merely its hash. The input is told apart by a generation number rather than by its
+ *  address, which a new input may well reuse: the cache is emptied whenever the generation
+ *  differs from the one of its ranges.
+ *
+ *  \param[in,out] cache       Pointer to the cache to use.
+ *  \param[in]     eq          Pointer to equalizer to use for processing the signal.
+ *  \param[in]     in          Pointer to input signal.
+ *  \param[in]     generation  Number which the caller changes whenever the samples of in change,
+ *                             e.g. a count of the inputs loaded so far. Never 0.
+ *  \param[in]     start       First sample of the range. [0; in->num_samples]
+ *  \param[in]     end         Sample after the last one of the range. [start; in->num_samples]
+ *  \param[out]    out         Pointer to a sound to be initialised with the processed samples.
+ */
+void eqmath_preview(eqmath_preview_cache *cache, const equalizer *eq, const sound *in,
+                    unsigned long long generation, int64_t start, int64_t end, sound *out);
+
+/** \brief Initialise an empty stage cache.
+ *
+ *  \param[out] cache   Pointer to the cache to initialise.
+ *  \param[in]  budget  Most bytes of samples the cache may hold.
+ */
+void eqmath_stage_cache_init(eqmath_stage_cache *cache, unsigned long long budget);
+
+/** \brief Forget all checkpoints. Must be called whenever the samples of the input change.
+ *
+ *  \param[in,out] cache  Pointer to the cache to clear.
+ */
+void eqmath_stage_cache_invalidate(eqmath_stage_cache *cache);
+
+/** \brief Deallocates a stage cache.
+ *
+ *  \param[in,out] cache  Pointer to the cache to deallocate.
+ */
+void eqmath_stage_cache_delete(eqmath_stage_cache *cache);
+
+/** \brief Same as eqmath_process(), but resuming from the latest checkpoint in the cache which is
+ *         not affected by the changes since the previous render, and refreshing the checkpoints
+ *         after it.
+ *
+ *  Checkpoints only exist for the EQMATH_SERIAL engine; with any other, this is just
+ *  eqmath_process().
+ *
+ *  \param[in,out] cache              Pointer to the cache to use.
+ *  \param[in]     eq                 Pointer to equalizer to use for processing the signal.
+ *  \param[in]     in                 Pointer to input signal.
+ *  \param[out]    out                Pointer to a sound to be initialised with the resulting
+ *                                    signal.
+ *  \param[in]     progress_callback  Same as for eqmath_process().
+ */
+void eqmath_process_cached(eqmath_stage_cache *cache, const equalizer *eq, const sound *in,
+                           sound *out, void (*progress_callback)(double));
+
 /** \} */
 
 #endif // INCLUDED_EQMATH_H
@@ -0,0 +1,167 @@
+#include "fir.h"
+
+#include <stdlib.h> // malloc, calloc, free
+#include <string.h> // memcpy, memmove
+#include <math.h>   // cos, sin
+
+#define PI 3.14159265358979323846
+
+// w[k] = exp(-i pi k / m) for k in [0; m), the twiddles of a real transform of 2m points
+static double complex *make_twiddles(int m) {
+    double complex *w = malloc(m * sizeof(double complex));
+    for(int k = 0; k < m; k++) w[k] = cos(PI * k / m) - I * sin(PI * k / m);
+    return w;
+}
+
+// Complex FFT of m points in place, unnormalised. The inverse uses the conjugate twiddles.
+static void fft(double complex *z, int m, const double complex *w, int inverse) {
+    for(int i = 1, j = 0; i < m; i++) {
+        int bit = m >> 1;
+        for(; j & bit; bit >>= 1) j ^= bit;
+        j |= bit;
+        if(i < j) {
+            const double complex t = z[i];
+            z[i] = z[j];
+            z[j] = t;
+        }
+    }
+
+    for(int len = 2; len <= m; len <<= 1) {
+        const int half = len / 2, step = 2 * m / len;
+        for(int i = 0; i < m; i += len) {
+            for(int j = 0; j < half; j++) {
+                const double complex tw = inverse ? conj(w[j * step]) : w[j * step];
+                const double complex t = z[i + j + half] * tw;
+                z[i + j + half] = z[i + j] - t;
+                z[i + j] += t;
+            }
+        }
+    }
+}
+
+// Real FFT of 2m points x into the m + 1 bins X, through a complex FFT of the even and odd
+// samples packed together.
+static void rfft(const double *x, double complex *X, int m, const double complex *w, double complex *z) {
+    for(int k = 0; k < m; k++) z[k] = x[2 * k] + I * x[2 * k + 1];
+    fft(z, m, w, 0);
+
+    for(int k = 0; k <= m; k++) {
+        const double complex a = z[k % m], b = conj(z[(m - k) % m]);
+        const double complex twiddle = k < m ? w[k] : -1.0;
+        X[k] = 0.5 * (a + b) - 0.5 * I * twiddle * (a - b);
+    }
+}
+
+// Inverse of rfft(), scaled by m.
+static void irfft(const double complex *X, double *x, int m, const double complex *w, double complex *z) {
+    for(int k = 0; k < m; k++) {
+        const double complex a = X[k], b = conj(X[m - k]);
+        z[k] = 0.5 * (a + b) + 0.5 * I * conj(w[k]) * (a - b);
+    }
+    fft(z, m, w, 1);
+
+    for(int k = 0; k < m; k++) {
+        x[2 * k] = creal(z[k]);
+        x[2 * k + 1] = cimag(z[k]);
+    }
+}
+
+void fir_design(const double *magnitude, double *h) {
+    const int m = FIR_SIZE / 2;
+    double complex *w = make_twiddles(m);
+    double complex *X = malloc((m + 1) * sizeof(double complex));
+    double complex *z = malloc(m * sizeof(double complex));
+    double *zero_phase = malloc(FIR_SIZE * sizeof(double));
+
+    for(int k = 0; k <= m; k++) X[k] = magnitude[k];
+    irfft(X, zero_phase, m, w, z);
+
+    // centre the symmetric response on tap FIR_TAPS / 2 and taper its ends, a Tukey window
+    const int taper = FIR_TAPER * (FIR_TAPS + 1) / 2;
+    for(int t = 0; t < FIR_TAPS; t++) {
+        const int from = (t - FIR_TAPS / 2 + FIR_SIZE) % FIR_SIZE;
+        const int edge = (t < FIR_TAPS - 1 - t ? t : FIR_TAPS - 1 - t) + 1;
+        const double window = edge >= taper ? 1.0 : 0.5 - 0.5 * cos(PI * edge / taper);
+        h[t] = zero_phase[from] / m * window;
+    }
+
+    free(w);
+    free(X);
+    free(z);
+    free(zero_phase);
+}
+
+void fir_convolver_init(fir_convolver *c, const double *h, int taps) {
+    fir_convolver_delete(c);
+
+    const int bins = FIR_BLOCK + 1;
+    c->partitions = (taps + FIR_BLOCK - 1) / FIR_BLOCK;
+    c->twiddles = make_twiddles(FIR_BLOCK);
+    c->spectra = malloc(c->partitions * bins * sizeof(double complex));
+    c->history = calloc(c->partitions * bins, sizeof(double complex));
+    c->input = calloc(2 * FIR_BLOCK, sizeof(double));
+    c->output = calloc(FIR_BLOCK, sizeof(double));
+    c->scratch = malloc(FIR_BLOCK * sizeof(double complex));
+    c->sum = malloc(bins * sizeof(double complex));
+    c->wrapped = malloc(2 * FIR_BLOCK * sizeof(double));
+
+    // each partition zero-padded to two blocks, scaled to undo the gain of irfft()
+    double *padded = calloc(2 * FIR_BLOCK, sizeof(double));
+    for(int p = 0; p < c->partitions; p++) {
+        for(int t = 0; t < FIR_BLOCK; t++)
+            padded[t] = p * FIR_BLOCK + t < taps ? h[p * FIR_BLOCK + t] / FIR_BLOCK : 0.0;
+        rfft(padded, c->spectra + p * bins, FIR_BLOCK, c->twiddles, c->scratch);
+    }
+    free(padded);
+}
+
+// Convolve the latest two blocks of input with the whole filter into the next block of output.
+static void convolve_block(fir_convolver *c) {
+    const int bins = FIR_BLOCK + 1;
+    c->newest = (c->newest + 1) % c->partitions;
+    rfft(c->input, c->history + c->newest * bins, FIR_BLOCK, c->twiddles, c->scratch);
+
+    // block j ago meets partition j
+    double complex *sum = c->sum;
+    for(int k = 0; k < bins; k++) sum[k] = 0.0;
+    for(int p = 0; p < c->partitions; p++) {
+        const double complex *spectrum = c->spectra + p * bins;
+        const double complex *block = c->history + (c->newest - p + c->partitions) % c->partitions * bins;
+        for(int k = 0; k < bins; k++) sum[k] += spectrum[k] * block[k];
+    }
+
+    // the first half of the circular convolution wraps around; only the second half is kept
+    irfft(sum, c->wrapped, FIR_BLOCK, c->twiddles, c->scratch);
+    memcpy(c->output, c->wrapped + FIR_BLOCK, FIR_BLOCK * sizeof(double));
+    memmove(c->input, c->input + FIR_BLOCK, FIR_BLOCK * sizeof(double));
+}
+
+void fir_convolver_run(fir_convolver *c, double *x, int64_t n) {
+    while(n > 0) {
+        const int count = n < FIR_BLOCK - c->fill ? n : FIR_BLOCK - c->fill;
+        memcpy(c->input + FIR_BLOCK + c->fill, x, count * sizeof(double));
+        memcpy(x, c->output + c->fill, count * sizeof(double));
+        c->fill += count;
+        x += count;
+        n -= count;
+
+        if(c->fill == FIR_BLOCK) {
+            convolve_block(c);
+            c->fill = 0;
+        }
+    }
+}
+
+void fir_convolver_delete(fir_convolver *c) {
+    free(c->twiddles);
+    free(c->spectra);
+    free(c->history);
+    free(c->input);
+    free(c->output);
+    free(c->scratch);
+    free(c->sum);
+    free(c->wrapped);
+
+    const fir_convolver empty = { 0 };
+    *c = empty;
+}
@@ -0,0 +1,97 @@
+/** \file fir.h
+ *  \defgroup fir FIR module
+ *  \{
+ *  \brief The fir module designs linear-phase FIR filters from a magnitude response and applies
+ *         them by FFT convolution.
+ *
+ *  Filters are designed by frequency sampling. The magnitude response is sampled at the
+ *  FIR_SIZE / 2 + 1 bins of a real FFT of FIR_SIZE points and given zero phase. It is transformed
+ *  back into a symmetric impulse response, twice as long as the filter so that the response of
+ *  narrow bands barely wraps around, which is then cut to FIR_TAPS taps and delayed by half of
+ *  that to make it causal. Only the outer FIR_TAPER of the taps are tapered, by a cosine, so that
+ *  the cut rings little but peaks and notches are not smeared over more than the filter's
+ *  resolution of SAMPLERATE / FIR_TAPS, under a Hz. The filter thus has exactly the linear phase
+ *  of a FIR_TAPS / 2 sample delay, and its magnitude is the sampled one to within a fraction of a
+ *  dB, the worst for bands only a few Hz wide, whose response outlasts the filter.
+ *
+ *  Filters are applied by uniformly partitioned overlap-save convolution. The impulse response is
+ *  cut into partitions of FIR_BLOCK taps, each transformed once. The input is gathered into blocks
+ *  of FIR_BLOCK samples; each block is transformed together with the one before it, and the
+ *  spectra of the latest blocks are multiplied with those of the partitions and summed, so a
+ *  single inverse transform gives the next FIR_BLOCK output samples. The cost per sample depends
+ *  on the number of partitions and on log(FIR_BLOCK), but not on the response being applied.
+ *
+ *  The FFTs are radix-2 and in place, with real transforms computed as complex ones of half the
+ *  length.
+ *
+ *  If given an already initialised convolver, fir_convolver_init() deallocates the old data
+ *  before proceeding.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_FIR_H
+#define INCLUDED_FIR_H
+
+#include <stdint.h>     // int64_t
+#include <complex.h>
+
+#define FIR_TAPS 65535              /**< \brief Length of the designed filters, odd. */
+#define FIR_SIZE 131072             /**< \brief Points of the FFT filters are designed with. */
+#define FIR_TAPER 0.1               /**< \brief Fraction of the taps tapered, half at each end. */
+#define FIR_BLOCK 4096              /**< \brief Samples per block and taps per partition. */
+
+/** \brief Container for a filter's partitions and the state of the convolution. */
+typedef struct fir_convolver {
+    int partitions;
+    double complex *twiddles;   /**< \brief exp(-i pi k / FIR_BLOCK) for k in [0; FIR_BLOCK). */
+    double complex *spectra;    /**< \brief FIR_BLOCK + 1 bins of each partition. */
+    double complex *history;    /**< \brief FIR_BLOCK + 1 bins of each of the latest blocks. */
+    int newest;                 /**< \brief Index in history of the latest block. */
+    double *input;              /**< \brief The block before the current one, then the current one. */
+    double *output;             /**< \brief Output of the last complete block. */
+    int fill;                   /**< \brief Samples of the current block so far. */
+    double complex *scratch;    /**< \brief FIR_BLOCK bins for the transforms. */
+    double complex *sum;        /**< \brief FIR_BLOCK + 1 bins of the next output block. */
+    double *wrapped;            /**< \brief Two blocks of circular convolution, half of it wrapped. */
+} fir_convolver;
+
+/** \brief Design a linear-phase filter from its magnitude response.
+ *
+ *  \param[in]  magnitude  Array of FIR_SIZE / 2 + 1 linear gains, at the frequencies
+ *                         k * SAMPLERATE / FIR_SIZE.
+ *  \param[out] h          Array of FIR_TAPS doubles to receive the impulse response, symmetric
+ *                         around index FIR_TAPS / 2.
+ */
+void fir_design(const double *magnitude, double *h);
+
+/** \brief Initialise a convolver with a filter and silent state, deallocating previous data, if
+ *         any exists.
+ *
+ *  \param[out] c     Pointer to the convolver to initialise.
+ *  \param[in]  h     Impulse response.
+ *  \param[in]  taps  Length of h.
+ */
+void fir_convolver_init(fir_convolver *c, const double *h, int taps);
+
+/** \brief Filter the next samples of a signal in place.
+ *
+ *  The output lags the input by FIR_BLOCK samples, the time taken to gather a block, on top of
+ *  the delay of the filter itself: sample i of the output is the filter's output at i - FIR_BLOCK.
+ *
+ *  \param[in,out] c  Pointer to an initialised convolver.
+ *  \param[in,out] x  Samples to filter, any number at a time.
+ *  \param[in]     n  Number of samples.
+ */
+void fir_convolver_run(fir_convolver *c, double *x, int64_t n);
+
+/** \brief Deallocates a convolver, leaving it empty.
+ *
+ *  \param[in,out] c  Pointer to the convolver to deallocate.
+ */
+void fir_convolver_delete(fir_convolver *c);
+
+/** \} */
+
+#endif // INCLUDED_FIR_H
@@ -8,6 +8,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>  // atoi, malloc, free
 #include <time.h>    // clock, clock_t
 #include <string.h>
 #include <windows.h>
@@ -15,6 +16,11 @@
 #include "sound.h"
 #include "eq.h"
 #include "eqmath.h"
+#include "render.h"
+#include "bench.h"
+#include "autoeq.h"
+#include "overview.h"
+#include "cache.h"
 #include "ui.h"
 
 /** \brief Animates an input string to scroll over time within another fixed size string.
@@ -55,6 +61,11 @@ void sleep(clock_t delay) {
    while(clock() < when) Sleep(0);
 }
 
+#define STAGE_CACHE_BUDGET (512ull << 20) /**< \brief Bytes of checkpoints kept between renders. */
+#define MEMORY_LIMIT 2048                 /**< \brief Default ceiling of sample memory, in MiB. */
+#define RENDER_CACHE_BUDGET (512ull << 20) /**< \brief Bytes of whole renders kept in memory. */
+#define DISK_CACHE_BUDGET (4ull << 30)     /**< \brief Bytes of whole renders kept on disk. */
+
 char scrolling_filename[36] = { '\0' };    /**< \brief Will receive the scrolling input_filename. */
 
 /** \brief Used during audio processing, which is slow, to draw a progress bar in the bottom right.
@@ -86,59 +97,140 @@ void progress_callback(double progress) {
     ui_to_screen();
 }
 
-int main() {
+/** \brief Entry point.
+ *
+ *  Usage: kayeq [number of bands] [serial|parallel|linear] [memory limit in MiB] [cache directory]
+ *         kayeq --bench [number of bands]
+ *         kayeq --check [number of bands]
+ *
+ *  \param[in] argc  Number of command line arguments.
+ *  \param[in] argv  Command line arguments; the optional first one selects the number of bands, the
+ *                   optional second one the processing engine, the optional third one the
+ *                   ceiling of memory for samples (0 for none), the optional fourth one an existing
+ *                   directory to keep renders in between runs. With --bench, the benchmarks are
+ *                   printed instead of starting the user interface; with --check, the checks,
+ *                   at each of BENCH_CHECK_BAND_COUNTS unless a number of bands is given, which
+ *                   also set the exit code.
+ */
+int main(int argc, char **argv) {
     bool running = true;                /**< \brief Set true until the user chooses to exit the
                                                     program. */
 
     char input_filename[67] = { '\0' }; /**< \brief Empty string means no file is loaded. */
     sound input_sound = { 0 };          /**< \brief Sound loaded from file given by input_filename. */
     char *input_error = "";             /**< \brief Describes error of last sound_load() call. */
+    bool input_streamed = false;        /**< \brief Set true if the input has several channels or
+                                                    does not fit under the memory ceiling, so it is
+                                                    never loaded and only rendered straight from
+                                                    the file, by render_file(). */
+    uint64_t input_hash = 0;            /**< \brief Hash of input_sound for the render cache, see
+                                                    cache_hash_sound(). */
+    overview input_overview = { 0 };    /**< \brief Waveform overview of input_sound, empty if
+                                                    input_streamed. */
 
     char output_filename[67] = { '\0' };/**< \brief Filename to output to. */
     sound output_sound = { 0 };         /**< \brief Filtered sound. */
+    char output_status[36] = { '\0' }; /**< \brief Levels of the last saved sound. */
+    overview output_overview = { 0 };   /**< \brief Waveform overview of the last render. */
+
+    int cursor_pos = 0;                 /**< \brief 0..(nfreq-1); Selected frequency index. */
 
-    int cursor_pos = 0;                 /**< \brief 0..(NFREQ-1); Selected frequency index. */
+    equalizer eq = { 0 };               /**< \brief Container for the equalizer state. */
 
-    equalizer eq;                       /**< \brief Container for the equalizer state. */
+    autoeq_job autoeq;                  /**< \brief Fit to a target curve running in the background. */
+    bool fitting = false;               /**< \brief Set true while autoeq is running. */
+
+    eqmath_stage_cache stage_cache;     /**< \brief Checkpoints of the last render of input_sound. */
+    eqmath_stage_cache_init(&stage_cache, STAGE_CACHE_BUDGET);
+    cache render_cache = { 0 };         /**< \brief Whole renders, keyed by input and settings. */
+
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        int bench_nfreq = argc > 2 ? atoi(argv[2]) : NFREQ;
+        if(bench_nfreq < MINNFREQ || bench_nfreq > MAXNFREQ) bench_nfreq = NFREQ;
+        bench_run(stdout, bench_nfreq);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "--check") == 0) {
+        int check_nfreq = argc > 2 ? atoi(argv[2]) : 0;
+        if(check_nfreq < MINNFREQ || check_nfreq > MAXNFREQ) check_nfreq = 0;
+        return bench_check_all(stdout, check_nfreq) ? 0 : 1;
+    }
 
-    eq_init(&eq);
+    int nfreq = argc > 1 ? atoi(argv[1]) : NFREQ;
+    if(nfreq < MINNFREQ || nfreq > MAXNFREQ) nfreq = NFREQ;
+
+    if(argc > 2 && strcmp(argv[2], "parallel") == 0) eqmath_set_engine(EQMATH_PARALLEL);
+    if(argc > 2 && strcmp(argv[2], "linear") == 0) eqmath_set_engine(EQMATH_LINEAR_PHASE);
+    sound_set_memory_limit((argc > 3 ? strtoull(argv[3], NULL, 10) : MEMORY_LIMIT) << 20);
+    cache_init(&render_cache, RENDER_CACHE_BUDGET, argc > 4 ? argv[4] : NULL, DISK_CACHE_BUDGET);
+
+    eq_init(&eq, nfreq);
     eqmath_init(&eq);
     ui_init();
 
+    double *selected_curve = malloc(nfreq * sizeof(double));
+    double *overall_curve = malloc(nfreq * sizeof(double));
+    double *target_curve = malloc(nfreq * sizeof(double));
+
     while(running) {
         // If no file is loaded, display the prompt.
         if(input_filename[0] == '\0') {
             ui_prompt("Input wav file", input_error, input_filename, sizeof(input_filename));
-            input_error = sound_load(&input_sound, input_filename);
+            eqmath_stage_cache_invalidate(&stage_cache);
+            sound_delete(&input_sound); // the previous input does not count against the new one
+            overview_delete(&input_overview);
+
+            // only the headers are read at first, to decide whether the samples can be loaded
+            sound_map input_map;
+            input_error = sound_map_open(&input_map, input_filename);
+            if(input_error[0] == '\0') {
+                const unsigned long long input_bytes =
+                    sound_resampled_length(input_map.num_samples, input_map.sample_rate) * sizeof(double);
+                input_streamed = input_map.channels != 1 || !sound_memory_allows(input_bytes);
+                sound_map_close(&input_map);
+                if(!input_streamed) input_error = sound_load(&input_sound, input_filename);
+            }
+
             if(input_error[0] != '\0') {
                 input_filename[0] = '\0';
+            } else if(!input_streamed) {
+                input_hash = cache_hash_sound(&input_sound);
+                overview_build(&input_overview, input_sound.samples, input_sound.num_samples, 1);
             }
             continue;
         }
 
         marquee(input_filename, scrolling_filename, 35);
 
+        // Show the latest solution of the auto-EQ fit as it converges
+        if(fitting) {
+            double rms_db;
+            fitting = autoeq_job_poll(&autoeq, &eq, &rms_db);
+            snprintf(output_status, sizeof(output_status), "%s %.2fdB RMS error",
+                     fitting ? "Fitting..." : "Auto-EQ", rms_db);
+            if(!fitting) autoeq_job_finish(&autoeq);
+        }
+
         // Draw UI elements
         ui_options();
         ui_scale();
-        ui_status(scrolling_filename, "");
+        ui_status(scrolling_filename, output_status);
 
         // Calculate curves to be drawn & convert gain to dB
-        double selected_curve[NFREQ] = { 0 };
         eqmath_one_frequency_response(&eq, selected_curve, cursor_pos);
-        for(int i = 0; i < NFREQ; i++)
+        for(int i = 0; i < nfreq; i++)
             selected_curve[i] = eqmath_gain_to_db(selected_curve[i]);
 
-        double overall_curve[NFREQ] = { 0 };
         eqmath_overall_frequency_response(&eq, overall_curve);
-        for(int i = 0; i < NFREQ; i++)
+        for(int i = 0; i < nfreq; i++)
             overall_curve[i] = eqmath_gain_to_db(overall_curve[i]);
 
         // Draw frequency response curves and cursor
         ui_clear_curves();
         ui_cursor(&eq, cursor_pos, overall_curve[cursor_pos]);
-        ui_curve(selected_curve, FGRAY);
-        ui_curve(overall_curve, FWHITE);
+        ui_curve(selected_curve, nfreq, FGRAY);
+        ui_curve(overall_curve, nfreq, FWHITE);
 
         // Flush all UI to screen
         ui_to_screen();
@@ -146,30 +238,92 @@ int main() {
         // Process user input
         char command = ui_getchar_nonblocking();
         if(command >= 'a' && command <= 'z') command -= 32;
+
+        // Any key stops the fit, keeping the solution shown so far
+        if(fitting && command != 0) {
+            autoeq_job_finish(&autoeq);
+            fitting = false;
+        }
+
         switch(command) {
         case 'O': { // [O] Open
             input_filename[0] = '\0';   // Reset filename so we reload next iteration
             break;
         }
         case 'S': { // [S] Save
+            ui_prompt("Output wav file (empty for playback)", "", output_filename,
+                      sizeof(output_filename));
+
             ui_status(scrolling_filename, "Processing...");
             ui_clear_curves();
             ui_cursor(&eq, cursor_pos, overall_curve[cursor_pos]);
-            ui_curve(selected_curve, FGRAY);
-            ui_curve(overall_curve, FWHITE);
+            ui_curve(selected_curve, nfreq, FGRAY);
+            ui_curve(overall_curve, nfreq, FWHITE);
             ui_to_screen();
 
-            eqmath_process(&eq, &input_sound, &output_sound, progress_callback);
-
-            ui_prompt("Output wav file (empty for playback)", "", output_filename,
-                      sizeof(output_filename));
-
+            if(output_filename[0] == '\0' && input_streamed) {
+                snprintf(output_status, sizeof(output_status), "Too large to play, save it instead");
+                break;
+            }
             if(output_filename[0] == '\0') {
+                sound_stats rendered;
+                cache_process(&render_cache, &stage_cache, &eq, &input_sound, input_hash, &output_sound,
+                              &rendered, progress_callback);
+                if(output_sound.samples == NULL && input_sound.num_samples > 0) {
+                    snprintf(output_status, sizeof(output_status), "Not enough memory to render");
+                    break;
+                }
+                overview_build(&output_overview, output_sound.samples, output_sound.num_samples, 1);
                 sound_play(&output_sound);
+                break;
+            }
+
+            sound_stats written;
+            char *output_error;
+            sound_delete(&output_sound);
+            const unsigned long long output_bytes = input_sound.num_samples * sizeof(double);
+            if(input_streamed || output_bytes > STAGE_CACHE_BUDGET || !sound_memory_allows(output_bytes)) {
+                // never loaded, too long for any checkpoint to fit, or for the output to fit in
+                // memory at all, so stream the file through instead
+                output_error = render_file(&eq, input_filename, output_filename, &sound_format_default,
+                                           &written, &output_overview, progress_callback);
+            } else {
+                sound_stats rendered;
+                cache_process(&render_cache, &stage_cache, &eq, &input_sound, input_hash, &output_sound,
+                              &rendered, progress_callback);
+                if(output_sound.samples == NULL && input_sound.num_samples > 0) {
+                    snprintf(output_status, sizeof(output_status), "Not enough memory to render");
+                    break;
+                }
+                output_error = sound_save_as(&output_sound, output_filename,
+                                             &sound_format_default, &rendered, &written);
+                overview_build(&output_overview, output_sound.samples, output_sound.num_samples, 1);
+                overview_scale(&output_overview, sound_format_gain(&sound_format_default, &rendered));
+            }
+
+            if(output_error[0] != '\0') {
+                snprintf(output_status, sizeof(output_status), "%s", output_error);
             } else {
-                sound_save(&output_sound, output_filename);
+                snprintf(output_status, sizeof(output_status), "Peak %+.1fdB RMS %+.1fdB %lld clip",
+                         eqmath_gain_to_db(written.peak),
+                         eqmath_gain_to_db(sound_stats_rms(&written)), written.clipped);
+            }
+
+            break;
+        }
+        case 'A': { // [A] Auto-EQ
+            char target_filename[67] = { '\0' };
+            ui_prompt("Target curve file (Hz, dB per line)", "", target_filename,
+                      sizeof(target_filename));
+
+            char *target_error = autoeq_load_target(target_filename, &eq, target_curve);
+            if(target_error[0] != '\0') {
+                snprintf(output_status, sizeof(output_status), "%s", target_error);
+                break;
             }
 
+            autoeq_job_start(&autoeq, &eq, target_curve);
+            fitting = true;
             break;
         }
         case '0':   // [0-9] Q factor
@@ -193,7 +347,7 @@ int main() {
 
             if(arrow == 'A') eq_change_gain(&eq, cursor_pos, +1);
             if(arrow == 'B') eq_change_gain(&eq, cursor_pos, -1);
-            if(arrow == 'C') if(cursor_pos < 74) cursor_pos++;
+            if(arrow == 'C') if(cursor_pos < nfreq - 1) cursor_pos++;
             if(arrow == 'D') if(cursor_pos > 0) cursor_pos--;
             break;
         }
@@ -208,8 +362,17 @@ int main() {
         sleep(0.01 * CLOCKS_PER_SEC);
     }
 
+    if(fitting) autoeq_job_finish(&autoeq);
     sound_delete(&input_sound);
     sound_delete(&output_sound);
+    overview_delete(&input_overview);
+    overview_delete(&output_overview);
+    eq_delete(&eq);
+    eqmath_stage_cache_delete(&stage_cache);
+    cache_delete(&render_cache);
+    free(selected_curve);
+    free(overall_curve);
+    free(target_curve);
 
     ui_reset();
 
@@ -0,0 +1,136 @@
+#include "overview.h"
+
+#include <stdlib.h> // malloc, realloc, free
+#include <math.h>   // INFINITY, fmin, fmax, fminf, fmaxf, sqrt
+
+static const overview_entry empty_entry = { INFINITY, -INFINITY, 0.0 };
+
+static overview_entry merge(overview_entry a, overview_entry b) {
+    const overview_entry merged = { fminf(a.min, b.min), fmaxf(a.max, b.max), a.sum_squares + b.sum_squares };
+    return merged;
+}
+
+void overview_init(overview *ov, int channels) {
+    overview_delete(ov);
+    ov->channels = channels;
+}
+
+void overview_append(overview *ov, const double *x, int64_t n) {
+    const int channels = ov->channels;
+    while(n > 0) {
+        // up to the end of the pending block
+        const int64_t room = OVERVIEW_BLOCK - ov->num_frames % OVERVIEW_BLOCK;
+        const int64_t count = n < room ? n : room;
+
+        double lo = ov->pending.min, hi = ov->pending.max, sum_squares = 0.0;
+        for(int64_t i = 0; i < count * channels; i++) {
+            lo = fmin(lo, x[i]);
+            hi = fmax(hi, x[i]);
+            sum_squares += x[i] * x[i];
+        }
+        ov->pending.min = lo;
+        ov->pending.max = hi;
+        ov->pending.sum_squares += sum_squares;
+        ov->num_frames += count;
+        x += count * channels;
+        n -= count;
+
+        if(ov->num_frames % OVERVIEW_BLOCK == 0) {
+            if(ov->sizes[0] == ov->capacity) {
+                ov->capacity = ov->capacity ? 2 * ov->capacity : 1024;
+                ov->levels[0] = realloc(ov->levels[0], ov->capacity * sizeof(overview_entry));
+            }
+            ov->levels[0][ov->sizes[0]++] = ov->pending;
+            ov->pending = empty_entry;
+        }
+    }
+}
+
+void overview_finish(overview *ov) {
+    if(ov->num_frames % OVERVIEW_BLOCK != 0) {
+        ov->levels[0] = realloc(ov->levels[0], (ov->sizes[0] + 1) * sizeof(overview_entry));
+        ov->capacity = ov->sizes[0] + 1;
+        ov->levels[0][ov->sizes[0]++] = ov->pending;
+        ov->pending = empty_entry;
+    }
+    if(ov->sizes[0] == 0) return;
+
+    int level = 0;
+    while(ov->sizes[level] > 1) {
+        const int64_t size = (ov->sizes[level] + 1) / 2;
+        const overview_entry *below = ov->levels[level];
+        overview_entry *above = malloc(size * sizeof(overview_entry));
+        for(int64_t i = 0; i < size; i++)
+            above[i] = 2 * i + 1 < ov->sizes[level] ? merge(below[2 * i], below[2 * i + 1]) : below[2 * i];
+
+        level++;
+        ov->levels[level] = above;
+        ov->sizes[level] = size;
+    }
+    ov->num_levels = level + 1;
+}
+
+void overview_build(overview *ov, const double *x, int64_t n, int channels) {
+    overview_init(ov, channels);
+    overview_append(ov, x, n);
+    overview_finish(ov);
+}
+
+void overview_scale(overview *ov, double gain) {
+    for(int level = 0; level < ov->num_levels; level++) {
+        for(int64_t i = 0; i < ov->sizes[level]; i++) {
+            ov->levels[level][i].min *= gain;
+            ov->levels[level][i].max *= gain;
+            ov->levels[level][i].sum_squares *= gain * gain;
+        }
+    }
+}
+
+void overview_query(const overview *ov, int64_t start, int64_t end, int columns, overview_span *out) {
+    if(columns <= 0) return;
+    const overview_span silent = { 0.0, 0.0, 0.0 };
+    if(end <= start) {
+        for(int c = 0; c < columns; c++) out[c] = silent;
+        return;
+    }
+
+    // the coarsest level with entries no wider than a column, or level 0 for columns narrower
+    // than a frame; shifting width down cannot overflow
+    const int64_t width = (end - start) / columns;
+    int level = 0;
+    while(level + 1 < ov->num_levels && (width >> (level + 1)) >= OVERVIEW_BLOCK) level++;
+    const int64_t span = (int64_t) OVERVIEW_BLOCK << level;
+
+    for(int c = 0; c < columns; c++) {
+        const int64_t from = start + (end - start) * c / columns;
+        const int64_t to = start + (end - start) * (c + 1) / columns;
+        const int64_t first = from / span;
+        int64_t last = (to + span - 1) / span;
+        if(last <= first) last = first + 1;
+
+        out[c] = silent;
+        if(ov->num_levels == 0 || first >= ov->sizes[level]) continue;
+        if(last > ov->sizes[level]) last = ov->sizes[level];
+
+        overview_entry merged = empty_entry;
+        for(int64_t i = first; i < last; i++) merged = merge(merged, ov->levels[level][i]);
+
+        const int64_t frames = (last * span < ov->num_frames ? last * span : ov->num_frames) - first * span;
+        out[c].min = merged.min;
+        out[c].max = merged.max;
+        out[c].rms = sqrt(merged.sum_squares / ((double) frames * ov->channels));
+    }
+}
+
+void overview_delete(overview *ov) {
+    for(int level = 0; level < OVERVIEW_MAX_LEVELS; level++) {
+        free(ov->levels[level]);
+        ov->levels[level] = NULL;
+        ov->sizes[level] = 0;
+    }
+    ov->channels = 0;
+    ov->num_frames = 0;
+    ov->num_levels = 0;
+    ov->capacity = 0;
+    ov->pending = empty_entry;
+}
@@ -0,0 +1,114 @@
+/** \file overview.h
+ *  \defgroup overview Overview module
+ *  \{
+ *  \brief The overview module summarises a signal as a pyramid of min/max/RMS entries, so that a
+ *         waveform of any length can be drawn at any zoom level without scanning its samples.
+ *
+ *  Each entry of level 0 covers OVERVIEW_BLOCK frames, and each entry of level k+1 merges two
+ *  neighbouring entries of level k, up to a single entry covering the whole signal. The pyramid
+ *  takes under 2% of the memory of the signal it describes. A query picks the level whose entries
+ *  are just narrower than one column of the drawing, so it reads at most a few entries per column
+ *  whatever the length of the signal.
+ *
+ *  Overviews are built in a single pass as the samples are produced: the frames are fed block by
+ *  block to overview_append() and overview_finish() then builds the upper levels. Frames of
+ *  several channels are summarised together.
+ *
+ *  If given an already initialised overview, overview_init() deallocates the old data before
+ *  proceeding.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_OVERVIEW_H
+#define INCLUDED_OVERVIEW_H
+
+#include <stdint.h> // int64_t
+
+#define OVERVIEW_BLOCK 256      /**< \brief Frames covered by each entry of level 0. */
+#define OVERVIEW_MAX_LEVELS 64  /**< \brief More than the 56 levels of the longest int64_t signal. */
+
+/** \brief Summary of a run of frames. */
+typedef struct overview_entry {
+    float min, max;
+    double sum_squares;
+} overview_entry;
+
+/** \brief Levels of a part of a signal, as returned for each column by overview_query(). */
+typedef struct overview_span {
+    double min, max, rms;
+} overview_span;
+
+/** \brief Container for the pyramid of a signal. */
+typedef struct overview {
+    int channels;
+    int64_t num_frames;             /**< \brief Frames accounted for so far. */
+    int num_levels;                 /**< \brief Levels built by overview_finish(), 0 before. */
+    int64_t sizes[OVERVIEW_MAX_LEVELS];
+    overview_entry *levels[OVERVIEW_MAX_LEVELS];
+    int64_t capacity;               /**< \brief Entries allocated for level 0. */
+    overview_entry pending;         /**< \brief Level 0 entry of the last, incomplete block. */
+} overview;
+
+/** \brief Initialises an empty overview, deallocating previous data, if any exists.
+ *
+ *  \param[out] ov        Pointer to the overview to initialise.
+ *  \param[in]  channels  Number of interleaved channels of the frames to come.
+ */
+void overview_init(overview *ov, int channels);
+
+/** \brief Account for one more block of frames.
+ *
+ *  \param[in,out] ov  Pointer to an initialised overview.
+ *  \param[in]     x   Block of interleaved frames.
+ *  \param[in]     n   Number of frames in the block.
+ */
+void overview_append(overview *ov, const double *x, int64_t n);
+
+/** \brief Build the upper levels once all frames have been appended.
+ *
+ *  \param[in,out] ov  Pointer to an initialised overview.
+ */
+void overview_finish(overview *ov);
+
+/** \brief Initialise, append and finish in one call, for a signal which is already in memory.
+ *
+ *  \param[out] ov        Pointer to the overview to build.
+ *  \param[in]  x         Interleaved frames.
+ *  \param[in]  n         Number of frames.
+ *  \param[in]  channels  Number of channels.
+ */
+void overview_build(overview *ov, const double *x, int64_t n, int channels);
+
+/** \brief Multiply the levels of a finished overview, as if the signal had been amplified.
+ *
+ *  \param[in,out] ov    Pointer to a finished overview.
+ *  \param[in]     gain  Non-negative linear gain.
+ */
+void overview_scale(overview *ov, double gain);
+
+/** \brief Summarise a range of frames as a number of equally wide columns.
+ *
+ *  Column edges are rounded to the entries of the level used, so that each column reads at most
+ *  three or four of them. Columns narrower than OVERVIEW_BLOCK frames repeat the entry they fall
+ *  into. Columns past the end of the signal are silent. Nothing is written if columns is not
+ *  positive, and every column is silent if the range is empty.
+ *
+ *  \param[in]  ov       Pointer to a finished overview.
+ *  \param[in]  start    First frame of the range.
+ *  \param[in]  end      Frame after the last one of the range.
+ *  \param[in]  columns  Number of columns.
+ *  \param[out] out      Array of columns overview_span to receive the levels of each column.
+ */
+void overview_query(const overview *ov, int64_t start, int64_t end, int columns, overview_span *out);
+
+/** \brief Deallocates an overview, leaving it empty.
+ *
+ *  \param[in,out] ov  Pointer to the overview to deallocate.
+ */
+void overview_delete(overview *ov);
+
+/** \} */
+
+#endif // INCLUDED_OVERVIEW_H
@@ -0,0 +1,292 @@
+#include "render.h"
+#include "eqmath.h"
+
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memset, memmove
+#include <pthread.h> // pthread_create, pthread_join, pthread_mutex_t, pthread_cond_t
+
+// A block of interleaved frames; n == 0 marks the end of the signal.
+typedef struct block {
+    double *samples;
+    int n;                      // frames
+} block;
+
+// Bounded FIFO of blocks. Each queue can hold every block there is, so pushing never waits.
+typedef struct queue {
+    block items[RENDER_BLOCKS];
+    int head, size;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+} queue;
+
+static void queue_init(queue *q) {
+    q->head = q->size = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+}
+
+static void queue_delete(queue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+static void queue_push(queue *q, block b) {
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->size) % RENDER_BLOCKS] = b;
+    q->size++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static block queue_pop(queue *q) {
+    pthread_mutex_lock(&q->lock);
+    while(q->size == 0) pthread_cond_wait(&q->not_empty, &q->lock);
+    const block b = q->items[q->head];
+    q->head = (q->head + 1) % RENDER_BLOCKS;
+    q->size--;
+    pthread_mutex_unlock(&q->lock);
+    return b;
+}
+
+// Blocks go round from free to decoded (reader) to filtered (filters) and back to free (writer).
+typedef struct pipeline {
+    const sound_map *map;
+    int block_frames;           // input frames per block, fewer if resampling may add some
+    sound_writer *writer;       // NULL to only measure the output
+    overview *overview;         // of the output before the writer's gain, or NULL
+    char *error;                // first error of the writer, "" if none; read after joining it
+    queue free, decoded, filtered;
+} pipeline;
+
+static void *reader_main(void *arg) {
+    pipeline *p = arg;
+    const int64_t num_samples = p->map->num_samples;
+    for(int64_t start = 0; start < num_samples; start += p->block_frames) {
+        block b = queue_pop(&p->free);
+        b.n = num_samples - start < p->block_frames ? num_samples - start : p->block_frames;
+        sound_map_read(p->map, start, b.n, b.samples);
+        sound_map_release(p->map, start, b.n);
+        queue_push(&p->decoded, b);
+    }
+
+    block end = queue_pop(&p->free);
+    end.n = 0;
+    queue_push(&p->decoded, end);
+    return NULL;
+}
+
+static void *writer_main(void *arg) {
+    pipeline *p = arg;
+    for(;;) {
+        const block b = queue_pop(&p->filtered);
+        if(b.n == 0) return NULL;
+        // after an error the blocks still go round, so that the other threads can finish
+        if(p->writer != NULL && p->error[0] == '\0')
+            p->error = sound_writer_write(p->writer, b.samples, (int64_t) b.n * p->map->channels);
+        if(p->overview != NULL) overview_append(p->overview, b.samples, b.n);
+        queue_push(&p->free, b);
+    }
+}
+
+// Resample one block of every channel and filter it, leaving the output frames in the block.
+static int resample_block(block b, int channels, sound_resampler *resamplers, eqmath_stream *streams,
+                          bool last, double *planar, double *channel) {
+    for(int c = 0; c < channels; c++)
+        for(int i = 0; i < b.n; i++) planar[c * RENDER_BLOCK + i] = b.samples[i * channels + c];
+
+    // every channel is at the same position, so each produces the same number of frames
+    int m = 0;
+    for(int c = 0; c < channels; c++) {
+        m = sound_resampler_run(&resamplers[c], planar + c * RENDER_BLOCK, b.n, last, channel);
+        eqmath_stream_run(&streams[c], channel, m);
+        for(int i = 0; i < m; i++) b.samples[i * channels + c] = channel[i];
+    }
+    return m;
+}
+
+// Filter a block of frames at SAMPLERATE, each channel through its own stream.
+static void filter_block(block b, int channels, eqmath_stream *streams, double *channel) {
+    if(channels == 1) {
+        eqmath_stream_run(&streams[0], b.samples, b.n);
+        return;
+    }
+    for(int c = 0; c < channels; c++) {
+        for(int i = 0; i < b.n; i++) channel[i] = b.samples[i * channels + c];
+        eqmath_stream_run(&streams[c], channel, b.n);
+        for(int i = 0; i < b.n; i++) b.samples[i * channels + c] = channel[i];
+    }
+}
+
+// Drop the frames of a filtered block which only make up the latency of the streams, given the
+// number of frames filtered before it, and return the number of frames left.
+static int drop_latency(block b, int channels, int latency, int64_t filtered) {
+    if(filtered >= latency) return b.n;
+    const int skip = latency - filtered < b.n ? latency - filtered : b.n;
+    memmove(b.samples, b.samples + (size_t) skip * channels, (size_t) (b.n - skip) * channels * sizeof(double));
+    return b.n - skip;
+}
+
+// One pass of the whole pipeline over the input, with the filters running on the calling thread,
+// one stream per channel. Progress is reported in [progress_from; progress_to].
+static char *run_pipeline(const equalizer *eq, const sound_map *map, sound_writer *writer,
+                          overview *ov, sound_stats *rendered, void (*progress_callback)(double),
+                          double progress_from, double progress_to) {
+    sound_stats_reset(rendered);
+
+    // a block of input frames must not resample to more frames than a block holds
+    const bool resampling = map->sample_rate != SAMPLERATE;
+    const int64_t resampled_block = (int64_t) (RENDER_BLOCK - 2) * map->sample_rate / SAMPLERATE;
+    const int channels = map->channels;
+    double *samples = malloc((size_t) RENDER_BLOCKS * RENDER_BLOCK * channels * sizeof(double));
+    double *channel = malloc(RENDER_BLOCK * sizeof(double));
+    eqmath_stream *streams = calloc(channels, sizeof(eqmath_stream));
+    double *planar = resampling ? malloc((size_t) RENDER_BLOCK * channels * sizeof(double)) : NULL;
+    sound_resampler *resamplers = malloc(channels * sizeof(sound_resampler));
+    if(samples == NULL || channel == NULL || streams == NULL || (resampling && planar == NULL) ||
+       resamplers == NULL) {
+        free(samples);
+        free(channel);
+        free(streams);
+        free(planar);
+        free(resamplers);
+        return "Not enough memory to render";
+    }
+
+    pipeline p = {
+        .map = map,
+        .block_frames = !resampling || resampled_block > RENDER_BLOCK ? RENDER_BLOCK : resampled_block,
+        .writer = writer,
+        .overview = ov,
+        .error = ""
+    };
+    const int64_t out_frames = sound_resampled_length(map->num_samples, map->sample_rate);
+    queue_init(&p.free);
+    queue_init(&p.decoded);
+    queue_init(&p.filtered);
+    for(int i = 0; i < RENDER_BLOCKS; i++) {
+        const block b = { samples + (size_t) i * RENDER_BLOCK * channels, 0 };
+        queue_push(&p.free, b);
+    }
+
+    for(int c = 0; c < channels; c++)
+        eqmath_stream_init(&streams[c], eq);
+    for(int c = 0; c < channels; c++)
+        sound_resampler_init(&resamplers[c], map->sample_rate);
+    int64_t consumed = 0;
+    const int latency = eqmath_stream_latency(&streams[0]);
+    int64_t filtered = 0;
+
+    pthread_t reader, writer_thread;
+    if(pthread_create(&reader, NULL, reader_main, &p) != 0) {
+        p.error = "Could not start the reader thread";
+    } else if(pthread_create(&writer_thread, NULL, writer_main, &p) != 0) {
+        // the reader still goes through the whole input; its blocks go straight back
+        for(block b = queue_pop(&p.decoded); b.n != 0; b = queue_pop(&p.decoded)) queue_push(&p.free, b);
+        pthread_join(reader, NULL);
+        p.error = "Could not start the writer thread";
+    } else {
+        for(;;) {
+            block b = queue_pop(&p.decoded);
+            if(b.n == 0) {
+                // the last frames are still held back by the latency of the streams
+                for(int64_t flushed = 0; flushed < latency; ) {
+                    block zeros = queue_pop(&p.free);
+                    const int n = latency - flushed < RENDER_BLOCK ? latency - flushed : RENDER_BLOCK;
+                    zeros.n = n;
+                    memset(zeros.samples, 0, (size_t) n * channels * sizeof(double));
+                    filter_block(zeros, channels, streams, channel);
+                    zeros.n = drop_latency(zeros, channels, latency, filtered);
+                    filtered += n;
+                    flushed += n;
+                    sound_stats_update(rendered, zeros.samples, (int64_t) zeros.n * channels);
+                    queue_push(zeros.n > 0 ? &p.filtered : &p.free, zeros);
+                }
+                queue_push(&p.filtered, b);
+                break;
+            }
+
+            if(resampling) {
+                consumed += b.n;
+                b.n = resample_block(b, channels, resamplers, streams, consumed == map->num_samples,
+                                     planar, channel);
+            } else {
+                filter_block(b, channels, streams, channel);
+            }
+            const int n = b.n;
+            b.n = drop_latency(b, channels, latency, filtered);
+            filtered += n;
+            if(b.n == 0) {
+                // nothing to write yet; an empty block would read as the end
+                queue_push(&p.free, b);
+                continue;
+            }
+            sound_stats_update(rendered, b.samples, (int64_t) b.n * channels);
+
+            queue_push(&p.filtered, b);
+
+            progress_callback(progress_from + (progress_to - progress_from) * rendered->num_samples
+                                              / ((double) out_frames * channels));
+        }
+
+        pthread_join(reader, NULL);
+        pthread_join(writer_thread, NULL);
+    }
+
+    for(int c = 0; c < channels; c++)
+        eqmath_stream_delete(&streams[c]);
+    free(streams);
+    free(resamplers);
+    free(planar);
+    free(channel);
+    free(samples);
+    queue_delete(&p.free);
+    queue_delete(&p.decoded);
+    queue_delete(&p.filtered);
+    return p.error;
+}
+
+char *render_file(const equalizer *eq, const char *in_filename, const char *out_filename,
+                  const sound_format *format, sound_stats *written, overview *written_overview,
+                  void (*progress_callback)(double)) {
+    sound_map map;
+    char *err = sound_map_open(&map, in_filename);
+    if(err[0] != '\0') return err;
+
+    progress_callback(0.0);
+
+    double gain = 1.0;
+    double progress = 0.0;
+    if(format->normalize) {
+        sound_stats measured;
+        err = run_pipeline(eq, &map, NULL, NULL, &measured, progress_callback, 0.0, 0.5);
+        if(err[0] != '\0') {
+            sound_map_close(&map);
+            return err;
+        }
+        gain = sound_format_gain(format, &measured);
+        progress = 0.5;
+    }
+
+    sound_writer writer;
+    err = sound_writer_open(&writer, out_filename, sound_resampled_length(map.num_samples, map.sample_rate),
+                            map.channels, format, gain);
+    if(err[0] != '\0') {
+        sound_map_close(&map);
+        return err;
+    }
+
+    if(written_overview != NULL) overview_init(written_overview, map.channels);
+    sound_stats rendered;
+    err = run_pipeline(eq, &map, &writer, written_overview, &rendered, progress_callback, progress, 1.0);
+    char *close_err = sound_writer_close(&writer);
+    if(err[0] == '\0') err = close_err;
+    sound_map_close(&map);
+
+    if(written_overview != NULL) {
+        overview_finish(written_overview);
+        overview_scale(written_overview, gain);
+    }
+
+    if(written != NULL) *written = writer.stats;
+    return err;
+}
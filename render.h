@@ -0,0 +1,57 @@
+/** \file render.h
+ *  \defgroup render Render module
+ *  \{
+ *  \brief The render module equalizes a WAV file straight into another WAV file, without holding
+ *         either of them in memory.
+ *
+ *  The work is split into a pipeline of three stages which exchange fixed-size blocks of samples
+ *  through bounded queues: a reader thread decodes blocks from the mapped input file, the calling
+ *  thread runs the filters over them, and a writer thread encodes and writes them out. Disk I/O
+ *  and sample conversion thus overlap with filtering, and a render takes about as long as the
+ *  slowest of the stages rather than their sum.
+ *
+ *  Files of any length, channel count and sample rate are supported, each channel being resampled
+ *  to SAMPLERATE and filtered separately.
+ *  Pages of the input are released as soon as they are decoded, so even files much larger than
+ *  the memory never become resident.
+ *
+ *  \author Dragomir Ioan (trupples)
+ *  \author Dan Cristian
+ */
+
+#ifndef INCLUDED_RENDER_H
+#define INCLUDED_RENDER_H
+
+#include "eq.h"
+#include "sound.h"
+#include "overview.h"
+
+#define RENDER_BLOCK 16384  /**< \brief Frames per block passed between the stages. */
+#define RENDER_BLOCKS 8     /**< \brief Blocks in flight, shared by all the queues. */
+
+/** \brief Equalize a WAV file into another WAV file through the pipeline.
+ *
+ *  The filters are evaluated the same way as by eqmath_process_map(). Normalisation needs the
+ *  peak of the output before its first block can be written, so it costs a second pass of the
+ *  reader and filters.
+ *
+ *  \param[in]  eq                 Pointer to equalizer to use for processing the signal.
+ *  \param[in]  in_filename        Path to WAV file to read.
+ *  \param[in]  out_filename       Path to WAV file to write.
+ *  \param[in]  format             Pointer to the conversion options of the output.
+ *  \param[out] written            Pointer to receive statistics of the written samples, or NULL.
+ *  \param[out] written_overview   Pointer to an overview to build of the written samples, before
+ *                                 quantisation, or NULL.
+ *  \param[in]  progress_callback  double->void function which is called from the calling thread
+ *                                 after each block with a value in [0.0; 1.0] representing
+ *                                 current progress.
+ *
+ *  \return Empty string on success, description of the error otherwise.
+ */
+char *render_file(const equalizer *eq, const char *in_filename, const char *out_filename,
+                  const sound_format *format, sound_stats *written, overview *written_overview,
+                  void (*progress_callback)(double));
+
+/** \} */
+
+#endif // INCLUDED_RENDER_H
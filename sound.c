@@ -1,54 +1,116 @@
 #include "sound.h"
 
-#include <stdlib.h> // calloc, free
+#include <stdlib.h> // malloc, calloc, free
 #include <string.h> // memcpy
-#include <math.h>   // floor, ceil
-#include <stdint.h>
-#include <stdio.h>
+#include <math.h>   // fabs, fmax, pow, sqrt
+#include <errno.h>
 
-void sound_init(sound *snd, int num_samples) {
-    free(snd->samples); // shouldn't be necessary. it prevents double initialisation
-    snd->num_samples = num_samples;
+#ifdef _WIN32
+#include <windows.h> // CreateFileMapping, MapViewOfFile, GetSystemInfo
+#else
+#include <fcntl.h>    // open
+#include <unistd.h>   // close, sysconf
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#endif
+
+static sound_memory memory = { 0 };
+
+void sound_memory_get(sound_memory *m) {
+    *m = memory;
+}
+
+void sound_memory_reset_peak(void) {
+    memory.peak = memory.current;
+}
+
+void sound_set_memory_limit(unsigned long long limit) {
+    memory.limit = limit;
+}
+
+bool sound_memory_allows(unsigned long long bytes) {
+    return memory.limit == 0 || memory.current + bytes <= memory.limit;
+}
+
+bool sound_init(sound *snd, int64_t num_samples) {
+    sound_delete(snd); // shouldn't be necessary. it prevents double initialisation
 
     // dynamically allocate a list of zeros of the right length
     snd->samples = calloc(num_samples, sizeof(double));
+    if(snd->samples == NULL && num_samples > 0) return false;
+    snd->num_samples = num_samples;
+
+    memory.current += num_samples * sizeof(double);
+    if(memory.current > memory.peak) memory.peak = memory.current;
+    return true;
 }
 
 void sound_delete(sound *snd) {
     if(snd == NULL) return;
+    if(snd->samples != NULL) memory.current -= snd->num_samples * sizeof(double);
     snd->num_samples = 0;
     free(snd->samples);
     snd->samples = NULL;
 }
 
-void sound_copyinit(sound* dest, const sound *src) {
+bool sound_copyinit(sound* dest, const sound *src) {
     // initialise dest with a correct amount of zeros
-    sound_init(dest, src->num_samples);
+    if(!sound_init(dest, src->num_samples)) return false;
 
     // copy samples from src->samples to dest->samples, byte by byte
     memcpy(dest->samples, src->samples, sizeof(double) * src->num_samples);
+    return true;
 }
 
-void sound_resample(sound *out, const sound *in, int in_sample_rate) {
-    sound_init(out, (int) ceil(1.0 * in->num_samples * SAMPLERATE / in_sample_rate));
+int64_t sound_resampled_length(int64_t num_samples, int in_sample_rate) {
+    return (num_samples * SAMPLERATE + in_sample_rate - 1) / in_sample_rate;
+}
 
-    for(int i = 0; i < out->num_samples; i++) {
-        double in_pos = 1.0 * i * in_sample_rate / SAMPLERATE;
-        if(in_pos > in->num_samples) {
-            // BAD! Shouldn't happen!
-            in_pos = in->num_samples;
+void sound_resampler_init(sound_resampler *resampler, int in_sample_rate) {
+    const sound_resampler empty = { in_sample_rate, 0, 0, 0.0 };
+    *resampler = empty;
+}
+
+int64_t sound_resampler_run(sound_resampler *resampler, const double *x, int64_t n, bool last, double *y) {
+    const int64_t rate = resampler->in_sample_rate;
+    const int64_t available = resampler->num_in + n;
+    const int64_t end = last ? sound_resampled_length(available, rate) : INT64_MAX;
+
+    int64_t produced = 0;
+    for(int64_t i = resampler->num_out; i < end; i++) {
+        // output sample i lies at i * rate / SAMPLERATE in the input
+        const int64_t position = i * rate;
+        const int64_t lo = position / SAMPLERATE;
+        int64_t hi = lo + 1;
+        if(hi >= available) {
+            if(!last) break;
+            hi = available - 1;
         }
-        const double lo = in->samples[(int) floor(in_pos)];
-        const double hi = in->samples[(int) ceil(in_pos)];
-        const double fract = in_pos - floor(in_pos);
-        out->samples[i] = lo * (1 - fract) + hi * fract;
+
+        // everything before this block but its last sample has already been interpolated over
+        const double x_lo = lo < resampler->num_in ? resampler->last : x[lo - resampler->num_in];
+        const double x_hi = hi < resampler->num_in ? resampler->last : x[hi - resampler->num_in];
+        const double fract = (double) (position % SAMPLERATE) / SAMPLERATE;
+        y[produced++] = x_lo * (1 - fract) + x_hi * fract;
     }
+
+    resampler->num_out += produced;
+    resampler->num_in = available;
+    if(n > 0) resampler->last = x[n - 1];
+    return produced;
+}
+
+void sound_resample(sound *out, const sound *in, int in_sample_rate) {
+    sound_resampler resampler;
+    sound_resampler_init(&resampler, in_sample_rate);
+    if(!sound_init(out, sound_resampled_length(in->num_samples, in_sample_rate))) return;
+    sound_resampler_run(&resampler, in->samples, in->num_samples, true, out->samples);
 }
 
 #if BYTE_ORDER == LITTLE_ENDIAN
 
 struct riff_chunk {
-    uint32_t id;            // 0x46464952 'RIFF'
+    uint32_t id;            // 0x46464952 'RIFF', 0x34364652 'RF64' or 0x34365742 'BW64'
     uint32_t size;
     uint32_t format;        // 0x45564157 'WAVE'
 };
@@ -64,6 +126,19 @@ struct fmt__chunk {
     uint16_t bits_per_sample;
 };
 
+// First chunk of RF64/BW64 files, holding the sizes that overflow the 32-bit fields, which are
+// then set to 0xffffffff. 36 bytes on disk; sizeof includes padding at the end.
+struct ds64_chunk {
+    uint32_t id;            // 0x34367364 'ds64'
+    uint32_t size;
+    uint64_t riff_size;
+    uint64_t data_size;
+    uint64_t sample_count;
+    uint32_t table_length;
+};
+
+#define DS64_SIZE 36
+
 struct data_header {
     uint32_t id;            // 0x61746164 'data'
     uint32_t size;
@@ -75,124 +150,441 @@ struct wave_file {
     struct data_header data_header;
 };
 
-void sound_save(const sound *snd, const char *filename) {
-    FILE *f = fopen(filename, "wb");
+const sound_format sound_format_default = { CONVERT_S16, false, 0.0, false };
+
+void sound_stats_reset(sound_stats *stats) {
+    const sound_stats empty = { 0 };
+    *stats = empty;
+}
+
+void sound_stats_update(sound_stats *stats, const double *x, int64_t n) {
+    double peak = stats->peak, sum_squares = 0.0;
+    long long clipped = 0;
+    for(int64_t i = 0; i < n; i++) {
+        peak = fmax(peak, fabs(x[i]));
+        sum_squares += x[i] * x[i];
+        clipped += fabs(x[i]) > 1.0;
+    }
+    stats->peak = peak;
+    stats->sum_squares += sum_squares;
+    stats->num_samples += n;
+    stats->clipped += clipped;
+}
 
-    const struct wave_file wav_headers = {
+double sound_stats_rms(const sound_stats *stats) {
+    return stats->num_samples == 0 ? 0.0 : sqrt(stats->sum_squares / stats->num_samples);
+}
+
+double sound_format_gain(const sound_format *format, const sound_stats *rendered) {
+    if(!format->normalize || rendered->peak <= 0.0) return 1.0;
+    return pow(10.0, format->peak_db / 20.0) / rendered->peak;
+}
+
+// Close the file of a writer after a failed write, returning the description of the error.
+static char *writer_fail(sound_writer *writer) {
+    const int error = errno;
+    fclose(writer->file);
+    writer->file = NULL;
+    return strerror(error);
+}
+
+char *sound_writer_open(sound_writer *writer, const char *filename, int64_t num_samples, int channels, const sound_format *format, double gain) {
+    writer->file = fopen(filename, "wb");
+    if(writer->file == NULL) return strerror(errno);
+
+    writer->format = *format;
+    writer->gain = gain;
+    writer->dither_state = 0x2545f491;
+    sound_stats_reset(&writer->stats);
+
+    const int bytes = convert_bytes(format->type);
+    const bool floating = format->type == CONVERT_F32 || format->type == CONVERT_F64;
+    const uint64_t data_size = (uint64_t) bytes * channels * num_samples;
+    const bool rf64 = data_size > 0xffffffffull - 36;
+
+    struct wave_file wav_headers = {
         .riff = {
-            0x46464952,                 // 'RIFF'
-            36 + 2 * snd->num_samples,  // total size
-            0x45564157                  // 'WAVE'
+            0x46464952,                     // 'RIFF'
+            36 + data_size,                 // total size
+            0x45564157                      // 'WAVE'
         },
         .fmt_ = {
-            0x20746d66,                 // 'fmt '
-            16,                         // fmt size
-            1,                          // audio format = 1 PCM
-            1,                          // num channels
-            SAMPLERATE,                 // sample rate
-            SAMPLERATE * 2,             // byte rate
-            2,                          // block align
-            16                          // bits per sample
+            0x20746d66,                     // 'fmt '
+            16,                             // fmt size
+            floating ? 3 : 1,               // audio format = 1 PCM, 3 float
+            channels,                       // num channels
+            SAMPLERATE,                     // sample rate
+            SAMPLERATE * bytes * channels,  // byte rate
+            bytes * channels,               // block align
+            bytes * 8                       // bits per sample
         },
         .data_header = {
-            0x61746164,                 // 'data'
-            2 * snd->num_samples        // data size
+            0x61746164,                     // 'data'
+            data_size                       // data size
         }
     };
 
-    fwrite(&wav_headers, sizeof(wav_headers), 1, f);
+    if(!rf64) {
+        if(fwrite(&wav_headers, sizeof(wav_headers), 1, writer->file) != 1) return writer_fail(writer);
+        return "";
+    }
+
+    // too large for RIFF: the real sizes go to a ds64 chunk right after the RF64 header
+    const struct ds64_chunk ds64 = {
+        0x34367364,                         // 'ds64'
+        DS64_SIZE - 8,                      // ds64 size
+        4 + DS64_SIZE + sizeof(wav_headers.fmt_) + sizeof(wav_headers.data_header) + data_size,
+        data_size,
+        num_samples,
+        0                                   // no table of other chunk sizes
+    };
+    wav_headers.riff.id = 0x34364652;       // 'RF64'
+    wav_headers.riff.size = 0xffffffff;
+    wav_headers.data_header.size = 0xffffffff;
+
+    if(fwrite(&wav_headers.riff, sizeof(wav_headers.riff), 1, writer->file) != 1 ||
+       fwrite(&ds64, DS64_SIZE, 1, writer->file) != 1 ||
+       fwrite(&wav_headers.fmt_, sizeof(wav_headers.fmt_), 1, writer->file) != 1 ||
+       fwrite(&wav_headers.data_header, sizeof(wav_headers.data_header), 1, writer->file) != 1)
+        return writer_fail(writer);
+    return "";
+}
+
+// samples converted per fwrite call
+#define WRITE_BLOCK 4096
+
+// uniform in [0; 1), xorshift32
+static double dither_uniform(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state * (1.0 / 4294967296.0);
+}
+
+char *sound_writer_write(sound_writer *writer, const double *x, int64_t n) {
+    // size of 1 LSB relative to full scale; float samples are neither dithered nor clamped
+    static const double lsb[CONVERT_TYPES] = { 1.0 / 128, 1.0 / 32767, 1.0 / 8388607, 1.0 / 2147483647, 0.0, 0.0 };
+    const convert_type type = writer->format.type;
+    const double gain = writer->gain;
+
+    double noise[WRITE_BLOCK];
+    double scaled[WRITE_BLOCK];
+    unsigned char bytes[WRITE_BLOCK * 8];
+
+    for(int64_t start = 0; start < n; start += WRITE_BLOCK) {
+        const int count = n - start < WRITE_BLOCK ? n - start : WRITE_BLOCK;
+        const double *block = x + start;
+
+        // triangular noise, the difference of two uniform ones, spanning +-1 LSB
+        for(int i = 0; i < count; i++)
+            noise[i] = writer->format.dither && lsb[type] > 0.0
+                     ? (dither_uniform(&writer->dither_state) - dither_uniform(&writer->dither_state)) * lsb[type]
+                     : 0.0;
+
+        // gain, statistics and dither in one branch-free loop; clamping and rounding are left to
+        // the conversion kernels
+        double peak = writer->stats.peak, sum_squares = 0.0;
+        long long clipped = 0;
+        for(int i = 0; i < count; i++) {
+            const double y = block[i] * gain;
+            peak = fmax(peak, fabs(y));
+            sum_squares += y * y;
+
+            scaled[i] = y + noise[i];
+            clipped += (scaled[i] > 1.0) | (scaled[i] < -1.0);
+        }
+
+        writer->stats.peak = peak;
+        writer->stats.sum_squares += sum_squares;
+        writer->stats.num_samples += count;
+        writer->stats.clipped += clipped;
 
-    for(int i = 0; i < snd->num_samples; i++) {
-        double x = snd->samples[i] * 32767;
-        if(x < -32767) x = -32767;
-        if(x > 32767) x = 32767;
-        const uint16_t sample_data = (uint16_t) (int16_t) x;
-        fwrite(&sample_data, 2, 1, f);
+        convert_from_double(type, scaled, bytes, count);
+        if(fwrite(bytes, convert_bytes(type), count, writer->file) != (size_t) count) return strerror(errno);
     }
+    return "";
+}
 
-    fclose(f);
+char *sound_writer_close(sound_writer *writer) {
+    // buffered samples are only written out here, so closing can fail too
+    const bool closed = writer->file == NULL || fclose(writer->file) == 0;
+    writer->file = NULL;
+    return closed ? "" : strerror(errno);
 }
 
-char *sound_load(sound *snd, const char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if(f == NULL) return strerror(errno);
+char *sound_save_as(const sound *snd, const char *filename, const sound_format *format, const sound_stats *rendered, sound_stats *written) {
+    sound_stats measured;
+    if(format->normalize && rendered == NULL) {
+        sound_stats_reset(&measured);
+        sound_stats_update(&measured, snd->samples, snd->num_samples);
+        rendered = &measured;
+    }
+    const double gain = format->normalize ? sound_format_gain(format, rendered) : 1.0;
+
+    sound_writer writer;
+    char *err = sound_writer_open(&writer, filename, snd->num_samples, 1, format, gain);
+    if(err[0] != '\0') return err;
+
+    err = sound_writer_write(&writer, snd->samples, snd->num_samples);
+    char *close_err = sound_writer_close(&writer);
+    if(err[0] == '\0') err = close_err;
+
+    if(written != NULL) *written = writer.stats;
+    return err;
+}
+
+void sound_save(const sound *snd, const char *filename) {
+    sound_save_as(snd, filename, &sound_format_default, NULL, NULL);
+}
+
+#ifdef _WIN32
+
+static char *map_error(void) {
+    static char message[128];
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(),
+                   0, message, sizeof(message), NULL);
+    return message;
+}
 
-#define FAIL(err) { sound_delete(snd); fclose(f); return err; }
-#define TRY(stmt) stmt; if(ferror(f)) FAIL(strerror(errno))
+static char *map_file(sound_map *map, const char *filename) {
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE) return map_error();
+
+    LARGE_INTEGER size = { 0 };
+    if(!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG) sizeof(struct riff_chunk)) {
+        CloseHandle(file);
+        return "File is not a wav file";
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void *base = mapping == NULL ? NULL : MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(base == NULL) {
+        char *err = map_error();
+        if(mapping != NULL) CloseHandle(mapping);
+        CloseHandle(file);
+        return err;
+    }
+
+    map->base = base;
+    map->size = size.QuadPart;
+    map->handles[0] = file;
+    map->handles[1] = mapping;
+    return "";
+}
+
+static void unmap_file(sound_map *map) {
+    UnmapViewOfFile(map->base);
+    CloseHandle(map->handles[1]);
+    CloseHandle(map->handles[0]);
+}
+
+#else
+
+static char *map_file(sound_map *map, const char *filename) {
+    const int fd = open(filename, O_RDONLY);
+    if(fd < 0) return strerror(errno);
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(struct riff_chunk)) {
+        close(fd);
+        return "File is not a wav file";
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if(base == MAP_FAILED) return strerror(errno);
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    map->base = base;
+    map->size = st.st_size;
+    return "";
+}
+
+static void unmap_file(sound_map *map) {
+    munmap(map->base, map->size);
+}
+
+#endif
+
+char *sound_map_open(sound_map *map, const char *filename) {
+    const sound_map empty = { 0 };
+    *map = empty;
+
+    char *err = map_file(map, filename);
+    if(err[0] != '\0') return err;
+
+#define FAIL(err) { sound_map_close(map); return err; }
+
+    const unsigned char *p = map->base;
+    const unsigned char *end = p + map->size;
 
     struct riff_chunk riff = { 0 };
-    TRY(fread(&riff, sizeof(riff), 1, f));
+    memcpy(&riff, p, sizeof(riff));
+    p += sizeof(riff);
 
-    if(riff.id != 0x46464952 || riff.format != 0x45564157)
+    const bool rf64 = riff.id == 0x34364652 || riff.id == 0x34365742; // 'RF64', 'BW64'
+    if((riff.id != 0x46464952 && !rf64) || riff.format != 0x45564157)
         FAIL("File is not a wav file");
 
+    // RF64 keeps the sizes that do not fit 32 bits in a ds64 chunk, which must come first
+    struct ds64_chunk ds64 = { 0 };
+    uint64_t riff_size = riff.size;
+    if(rf64) {
+        if(end - p < DS64_SIZE) FAIL("File is not a wav file");
+        memcpy(&ds64, p, DS64_SIZE);
+        if(ds64.id != 0x34367364 || ds64.size < DS64_SIZE - 8) FAIL("File has no ds64 chunk");
+        riff_size = ds64.riff_size;
+    }
+
+    // the RIFF size may be bogus for files that were never finalised, trust the mapping instead
+    if(riff_size - 4 < (unsigned long long) (end - p)) end = p + riff_size - 4;
+
     struct fmt__chunk fmt = { 0 };
 
-    unsigned int remaining_bytes = riff.size - 4;
-    while(remaining_bytes > 0) {
+    while(end - p >= 8) {
         uint32_t next_chunk_id = 0;
-        uint32_t next_chunk_size = 0;
-        TRY(fread(&next_chunk_id, 4, 1, f));
-        TRY(fread(&next_chunk_size, 4, 1, f));
-        remaining_bytes -= 8;
+        uint32_t size32 = 0;
+        memcpy(&next_chunk_id, p, 4);
+        memcpy(&size32, p + 4, 4);
+
+        uint64_t next_chunk_size = size32;
+        if(rf64 && next_chunk_id == 0x61746164 && size32 == 0xffffffff) next_chunk_size = ds64.data_size;
+
+        // a truncated chunk still holds whatever bytes made it to disk
+        unsigned long long available = end - p - 8;
+        if(next_chunk_size > available) next_chunk_size = available;
 
         if(next_chunk_id == 0x20746d66) { // 'fmt '
-            TRY(fseek(f, -8, SEEK_CUR));
-            TRY(fread(&fmt, sizeof(fmt), 1, f));
-            TRY(fseek(f, next_chunk_size-sizeof(fmt)+8, SEEK_CUR)); // skip any extra fields
+            if(next_chunk_size + 8 < sizeof(fmt)) FAIL("Format chunk is inconsistent");
+            memcpy(&fmt, p, sizeof(fmt));
+
+            // WAVE_FORMAT_EXTENSIBLE keeps the actual format in the first 2 bytes of its subformat
+            if(fmt.audio_format == 0xfffe) {
+                if(next_chunk_size < 40) FAIL("Format chunk is inconsistent");
+                memcpy(&fmt.audio_format, p + 8 + 24, 2);
+            }
 
             // check format is something we can deal with
             if(fmt.audio_format != 1 && fmt.audio_format != 3)
                 FAIL("KayEQ only supports PCM and float audio formats");
 
-            if(fmt.channels != 1)
-                FAIL("KayEQ only supports mono audio");
+            if(fmt.channels == 0 || fmt.sample_rate == 0)
+                FAIL("Format chunk is inconsistent");
 
             if(fmt.block_align != fmt.bits_per_sample * fmt.channels / 8 ||
                     fmt.byte_rate != fmt.sample_rate * fmt.bits_per_sample * fmt.channels / 8)
                 FAIL("Format chunk is inconsistent");
+
+            if(fmt.audio_format == 1 && !convert_type_of(1, fmt.bits_per_sample, &map->type))
+                FAIL("KayEQ only supports 8, 16, 24 and 32 bit PCM");
+
+            if(fmt.audio_format == 3 && !convert_type_of(3, fmt.bits_per_sample, &map->type))
+                FAIL("KayEQ only supports 32 and 64 bit float");
         } else if(next_chunk_id == 0x61746164) { // 'data'
-            const uint32_t num_samples = next_chunk_size / fmt.block_align;
-            sound_init(snd, num_samples);
-
-            if(fmt.audio_format == 1) { // PCM
-                if(fmt.bits_per_sample == 8) {
-                    for(uint32_t i = 0; i < num_samples; i++) {
-                        uint8_t sample_data = 0;
-                        fread(&sample_data, 1, 1, f);
-                        snd->samples[i] = sample_data / 128.0 - 1.0;
-                    }
-                } else if(fmt.bits_per_sample == 16) {
-                    for(uint32_t i = 0; i < num_samples; i++) {
-                        int16_t sample_data = 0;
-                        fread(&sample_data, 2, 1, f);
-                        snd->samples[i] = sample_data / 32767.0;
-                    }
-                } else FAIL("KayEQ only supports 8 and 16 bit PCM");
-            } else if(fmt.audio_format == 3) { // float
-                if(fmt.bits_per_sample == 32) {
-                    for(uint32_t i = 0; i < num_samples; i++) {
-                        float sample = 0;
-                        fread(&sample, 4, 1, f);
-                        snd->samples[i] = sample;
-                    }
-                } else FAIL("KayEQ only supports 32 bit float");
-            }
-        } else {
-            TRY(fseek(f, next_chunk_size, SEEK_CUR)); // skip this chunk
+            if(fmt.block_align == 0) FAIL("Data chunk precedes format chunk");
+
+            map->num_samples = next_chunk_size / fmt.block_align;
+            map->channels = fmt.channels;
+            map->sample_rate = fmt.sample_rate;
+            map->audio_format = fmt.audio_format;
+            map->bits_per_sample = fmt.bits_per_sample;
+            map->data = p + 8;
+
+#undef FAIL
+
+            return "";
         }
-        remaining_bytes -= next_chunk_size;
+
+        p += 8 + next_chunk_size + (next_chunk_size & 1); // chunks are padded to even sizes
     }
 
-#undef TRY
-#undef FAIL
+    sound_map_close(map);
+    return "File has no data chunk";
+}
+
+// frames decoded per conversion call, keeping sample counts well within int
+#define READ_BLOCK (1 << 20)
+
+void sound_map_read(const sound_map *map, int64_t start, int64_t count, double *out) {
+    const int frame = convert_bytes(map->type) * map->channels;
+    for(int64_t done = 0; done < count; done += READ_BLOCK) {
+        const int n = count - done < READ_BLOCK ? count - done : READ_BLOCK;
+        convert_to_double(map->type, map->data + (start + done) * frame, out + done * map->channels,
+                          n * map->channels);
+    }
+}
 
-    fclose(f);
+// Size of the pages the map is made of.
+static uintptr_t page_size(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    const long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (uintptr_t) size : 4096;
+#endif
+}
 
-    sound before_resample = { 0 };
-    sound_copyinit(&before_resample, snd);
-    sound_resample(snd, &before_resample, fmt.sample_rate);
+void sound_map_release(const sound_map *map, int64_t start, int64_t count) {
+    const int frame = convert_bytes(map->type) * map->channels;
+
+    // only whole pages inside the range can go
+    const uintptr_t page = page_size();
+    const uintptr_t from = ((uintptr_t) (map->data + start * frame) + page - 1) / page * page;
+    const uintptr_t to = (uintptr_t) (map->data + (start + count) * frame) / page * page;
+    if(to <= from) return;
+
+#ifdef _WIN32
+    // unlocking pages that were never locked removes them from the working set
+    VirtualUnlock((void *) from, to - from);
+#else
+    madvise((void *) from, to - from, MADV_DONTNEED);
+#endif
+}
+
+void sound_map_close(sound_map *map) {
+    if(map->base != NULL) unmap_file(map);
+    const sound_map empty = { 0 };
+    *map = empty;
+}
+
+char *sound_load(sound *snd, const char *filename) {
+    sound_map map;
+    char *err = sound_map_open(&map, filename);
+    if(err[0] == '\0' && map.channels != 1) {
+        sound_map_close(&map);
+        err = "KayEQ only supports mono audio";
+    }
+    if(err[0] != '\0') {
+        sound_delete(snd);
+        return err;
+    }
+
+    if(!sound_init(snd, sound_resampled_length(map.num_samples, map.sample_rate))) {
+        sound_map_close(&map);
+        return "Not enough memory for the file";
+    }
+
+    if(map.sample_rate == SAMPLERATE) {
+        sound_map_read(&map, 0, map.num_samples, snd->samples);
+    } else {
+        // decode and resample block by block, straight into the sound
+        sound_resampler resampler;
+        sound_resampler_init(&resampler, map.sample_rate);
+        double *block = malloc(READ_BLOCK * sizeof(double));
+        int64_t produced = 0;
+        for(int64_t start = 0; start < map.num_samples; start += READ_BLOCK) {
+            const int64_t n = map.num_samples - start < READ_BLOCK ? map.num_samples - start : READ_BLOCK;
+            sound_map_read(&map, start, n, block);
+            produced += sound_resampler_run(&resampler, block, n, start + n == map.num_samples,
+                                            snd->samples + produced);
+        }
+        free(block);
+    }
 
+    sound_map_close(&map);
     return "";
 }
 
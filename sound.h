@@ -7,11 +7,23 @@
  *
  *  All in-memory sounds are expected to have a fixed sample rate, defined by SAMPLERATE. The
  *  sound_resample() function enables the conversion of a sound of a different sample rate to the
- *  expected one.
+ *  expected one; a sound_resampler does the same conversion one block at a time.
  *
  *  If given an already initialised sound, all initialisation functions deallocate the old data
  *  before proceeding.
  *
+ *  The bytes of samples held by all sounds are counted as they are allocated and deallocated, and
+ *  may be given a ceiling. Nothing fails when the ceiling is exceeded; instead, renders check
+ *  sound_memory_allows() to pick a strategy which needs fewer whole-signal buffers.
+ *
+ *  WAV files can also be opened as a sound_map, a read-only memory-mapped view of the file. The
+ *  RIFF chunks are parsed in place and samples are only decoded when asked for, so opening even a
+ *  very long file is nearly instant and only the pages actually being processed become resident.
+ *
+ *  Sounds are written through a sound_writer, which in a single pass over the samples applies a
+ *  gain, adds optional TPDF dither, clamps to full scale, quantises to the chosen format and gathers
+ *  the level statistics of what was written, including how many samples had to be clipped.
+ *
  *  \author Dragomir Ioan (trupples)
  *  \author Dan Cristian
  */
@@ -19,12 +31,17 @@
 #ifndef INCLUDED_SOUND_H
 #define INCLUDED_SOUND_H
 
+#include <stdbool.h> // bool
+#include <stdint.h>  // uint32_t, int64_t
+#include <stdio.h>   // FILE
+#include "convert.h"
+
 #define SAMPLERATE 48000 /**< \brief Sample rate to be used for processing sounds. */
 
 /** \brief Container for a variable length one-channel signal.
  */
 typedef struct sound {
-    int num_samples;
+    int64_t num_samples;
     double *samples;
 } sound;
 
@@ -33,16 +50,21 @@ typedef struct sound {
  *
  *  \param[out] snd          Pointer to the sound object to initialise
  *  \param[in]  num_samples  Number of samples of silence to generate
+ *
+ *  \return Whether the samples could be allocated. If not, snd is left empty and nothing is
+ *          counted as sample memory.
  */
-void sound_init(sound *snd, int num_samples);
+bool sound_init(sound *snd, int64_t num_samples);
 
 /** \brief Copy-initialises a sound with data from another sound, deallocating previous data, if it
  *         exists.
  *
  *  \param[out] dst  Pointer to sound object to initialise
  *  \param[in]  src  Pointer to sound object to be copied
+ *
+ *  \return Whether the samples could be allocated, as for sound_init().
  */
-void sound_copyinit(sound *dst, const sound *src);
+bool sound_copyinit(sound *dst, const sound *src);
 
 /** \brief Deallocates a sound object.
  *
@@ -50,19 +72,247 @@ void sound_copyinit(sound *dst, const sound *src);
  */
 void sound_delete(sound *snd);
 
+/** \brief Bytes of samples held by all sounds together. */
+typedef struct sound_memory {
+    unsigned long long current;     /**< \brief Bytes allocated now. */
+    unsigned long long peak;        /**< \brief Most bytes allocated at once since the last reset. */
+    unsigned long long limit;       /**< \brief Ceiling, 0 for none. */
+} sound_memory;
+
+/** \brief Get the current and peak bytes of samples, and the ceiling.
+ *
+ *  Sounds are counted by sound_init() and sound_delete(), which must thus only be called from one
+ *  thread at a time.
+ *
+ *  \param[out] memory  Pointer to receive the counts.
+ */
+void sound_memory_get(sound_memory *memory);
+
+/** \brief Start measuring the peak again from the bytes allocated now. */
+void sound_memory_reset_peak(void);
+
+/** \brief Set the ceiling checked by sound_memory_allows().
+ *
+ *  \param[in] limit  Most bytes of samples to hold at once, 0 for no ceiling.
+ */
+void sound_set_memory_limit(unsigned long long limit);
+
+/** \brief Whether more samples can be allocated without exceeding the ceiling.
+ *
+ *  \param[in] bytes  Bytes of samples to allocate on top of the current ones.
+ */
+bool sound_memory_allows(unsigned long long bytes);
+
 /** \brief Converts a sound with a given sample rate to a sound with the constant SAMPLERATE sample
  *         rate.
  *
  *  \param[out] dst              Pointer to sound object to be initialised with the resampled data
  *  \param[in]  src              Pointer to sound object to be converted
  *  \param[in]  src_sample_rate  Sample rate to convert from
+ *
+ *  If the resampled data cannot be allocated, dst is left empty.
  */
 void sound_resample(sound *dst, const sound *src, int src_sample_rate);
 
-/** \brief Initialise sound with data from WAV file.
+/** \brief State of a conversion to SAMPLERATE which is fed the input one block at a time.
+ *
+ *  Each output sample is interpolated linearly between the two input samples around its position.
+ *  Positions are kept as exact fractions and only the last input sample is carried over between
+ *  blocks, so the output does not depend on how the input is split, and is the same as that of
+ *  sound_resample().
+ */
+typedef struct sound_resampler {
+    int in_sample_rate;
+    int64_t num_in;             /**< \brief Input samples received so far. */
+    int64_t num_out;            /**< \brief Output samples produced so far. */
+    double last;                /**< \brief Last input sample received. */
+} sound_resampler;
+
+/** \brief Number of samples a signal has once converted to SAMPLERATE.
+ *
+ *  \param[in] num_samples     Number of samples at the original rate.
+ *  \param[in] in_sample_rate  Original sample rate.
+ */
+int64_t sound_resampled_length(int64_t num_samples, int in_sample_rate);
+
+/** \brief Start a conversion.
+ *
+ *  \param[out] resampler       Pointer to the state to initialise.
+ *  \param[in]  in_sample_rate  Sample rate to convert from.
+ */
+void sound_resampler_init(sound_resampler *resampler, int in_sample_rate);
+
+/** \brief Convert the next block of the input.
+ *
+ *  Output samples which need input past the block are held back until the next one, or
+ *  interpolated towards the last input sample if this is the last block. A block of n samples
+ *  thus produces at most n * SAMPLERATE / in_sample_rate + 2 samples.
+ *
+ *  \param[in,out] resampler  Pointer to an initialised state.
+ *  \param[in]     x          Block of input samples.
+ *  \param[in]     n          Number of samples in the block.
+ *  \param[in]     last       Whether this is the last block of the input.
+ *  \param[out]    y          Array to receive the output samples.
+ *
+ *  \return Number of output samples produced.
+ */
+int64_t sound_resampler_run(sound_resampler *resampler, const double *x, int64_t n, bool last,
+                            double *y);
+
+/** \brief Read-only memory-mapped view of the data chunk of a WAV file.
+ *
+ *  Both RIFF and RF64/BW64 files are understood, so the data chunk may be larger than 4 GB.
+ *  Samples of files with several channels are interleaved, one frame after the other.
+ */
+typedef struct sound_map {
+    int64_t num_samples;        /**< \brief Number of frames, i.e. samples per channel. */
+    int channels;
+    int sample_rate;
+    int audio_format;           /**< \brief 1 for PCM, 3 for float. */
+    int bits_per_sample;
+    convert_type type;          /**< \brief Sample format of the data chunk. */
+    const unsigned char *data;  /**< \brief First byte of the data chunk, inside the mapping. */
+    void *base;                 /**< \brief Start of the whole file mapping. */
+    unsigned long long size;    /**< \brief Length of the whole file mapping, in bytes. */
+    void *handles[2];           /**< \brief OS file and mapping handles, where needed. */
+} sound_map;
+
+/** \brief Map a WAV file into memory and parse its headers, without decoding any sample.
+ *
+ *  \param[out] map       Pointer to the view to initialise.
+ *  \param[in]  filename  Path to WAV file to map.
+ *
+ *  \return Empty string on success, description of the error otherwise.
+ */
+char *sound_map_open(sound_map *map, const char *filename);
+
+/** \brief Decode a range of frames from the mapping, in the file's own sample rate.
+ *
+ *  \param[in]  map    Pointer to an open view.
+ *  \param[in]  start  Index of the first frame to decode. [0; num_samples)
+ *  \param[in]  count  Number of frames to decode. start + count must not exceed num_samples.
+ *  \param[out] out    Array of at least count * channels doubles to receive the decoded samples,
+ *                     interleaved like in the file.
+ */
+void sound_map_read(const sound_map *map, int64_t start, int64_t count, double *out);
+
+/** \brief Let the OS drop a range of frames that will not be read again from memory, so that
+ *         streaming through a file keeps only a window of it resident.
+ *
+ *  \param[in] map    Pointer to an open view.
+ *  \param[in] start  Index of the first frame to release.
+ *  \param[in] count  Number of frames to release.
+ */
+void sound_map_release(const sound_map *map, int64_t start, int64_t count);
+
+/** \brief Unmap a WAV file.
+ *
+ *  \param[in,out] map  Pointer to the view to close.
+ */
+void sound_map_close(sound_map *map);
+
+/** \brief Level statistics of a signal, gathered block by block while it is produced. */
+typedef struct sound_stats {
+    double peak;                /**< \brief Largest absolute sample value. */
+    double sum_squares;
+    long long num_samples;
+    long long clipped;          /**< \brief Samples outside of [-1.0; 1.0]. */
+} sound_stats;
+
+/** \brief How samples are converted when writing a WAV file. */
+typedef struct sound_format {
+    convert_type type;          /**< \brief Sample format of the file. */
+    bool normalize;             /**< \brief Scale the sound so that its peak reaches peak_db. */
+    double peak_db;             /**< \brief Level of the peak after normalisation, in dBFS. */
+    bool dither;                /**< \brief Add triangular dither of 1 LSB before quantising. */
+} sound_format;
+
+/** \brief Format used by sound_save(): 16 bits, no normalisation, no dither. */
+extern const sound_format sound_format_default;
+
+/** \brief WAV file being written block by block.
+ *
+ *  Files whose data would not fit the 32-bit sizes of RIFF are written as RF64.
+ */
+typedef struct sound_writer {
+    FILE *file;
+    sound_format format;
+    double gain;                /**< \brief Linear gain applied to every sample. */
+    uint32_t dither_state;      /**< \brief State of the dither noise generator. */
+    sound_stats stats;          /**< \brief Statistics of the written samples, after the gain;
+                                             clipped counts the samples beyond full scale, which
+                                             are clamped unless the format is float. */
+} sound_writer;
+
+/** \brief Reset level statistics, before gathering them for a new signal.
+ *
+ *  \param[out] stats  Pointer to the statistics to reset.
+ */
+void sound_stats_reset(sound_stats *stats);
+
+/** \brief Account for one more block of a signal in its level statistics.
+ *
+ *  \param[in,out] stats  Pointer to the statistics to update.
+ *  \param[in]     x      Block of samples.
+ *  \param[in]     n      Number of samples in the block.
+ */
+void sound_stats_update(sound_stats *stats, const double *x, int64_t n);
+
+/** \brief Root mean square level of the samples accounted for in some statistics.
+ *
+ *  \param[in] stats  Pointer to the statistics.
+ */
+double sound_stats_rms(const sound_stats *stats);
+
+/** \brief Linear gain applied to a signal when it is written with some conversion options.
+ *
+ *  \param[in] format    Pointer to the conversion options.
+ *  \param[in] rendered  Pointer to statistics of the whole signal.
+ *
+ *  \return Gain which brings the peak to format->peak_db if format->normalize is set and the
+ *          signal is not silent, 1.0 otherwise.
+ */
+double sound_format_gain(const sound_format *format, const sound_stats *rendered);
+
+/** \brief Create a WAV file and write its headers.
+ *
+ *  \param[out] writer       Pointer to the writer to initialise.
+ *  \param[in]  filename     Path to WAV file to write.
+ *  \param[in]  num_samples  Number of frames that will be written.
+ *  \param[in]  channels     Number of channels; samples of a frame are written interleaved.
+ *  \param[in]  format       Pointer to the conversion options. normalize is ignored here.
+ *  \param[in]  gain         Linear gain to apply to every sample.
+ *
+ *  \return Empty string on success, description of the error otherwise.
+ */
+char *sound_writer_open(sound_writer *writer, const char *filename, int64_t num_samples,
+                        int channels, const sound_format *format, double gain);
+
+/** \brief Convert and write the next block of samples.
+ *
+ *  \param[in,out] writer  Pointer to an open writer.
+ *  \param[in]     x       Block of samples.
+ *  \param[in]     n       Number of samples in the block, counting every channel.
+ *
+ *  \return Empty string on success, description of the error otherwise.
+ */
+char *sound_writer_write(sound_writer *writer, const double *x, int64_t n);
+
+/** \brief Close a WAV file.
+ *
+ *  \param[in,out] writer  Pointer to an open writer. Its stats stay available.
+ *
+ *  \return Empty string on success, description of the error otherwise, e.g. when the last
+ *          buffered samples could not be written.
+ */
+char *sound_writer_close(sound_writer *writer);
+
+/** \brief Initialise sound with data from a mono WAV file.
  *
  *  \param[out] snd       Pointer to sound to be initialised.
  *  \param[in]  filename  Path to WAV file to read.
+ *
+ *  \return Empty string on success, description of the error otherwise.
  */
 char *sound_load(sound *snd, const char *filename);
 
@@ -73,6 +323,21 @@ char *sound_load(sound *snd, const char *filename);
  */
 void sound_save(const sound *snd, const char *filename);
 
+/** \brief Store sound to disk as a WAV file with the given conversion options.
+ *
+ *  \param[in]  snd       Pointer to sound to store to disk.
+ *  \param[in]  filename  Path to WAV file to write.
+ *  \param[in]  format    Pointer to the conversion options.
+ *  \param[in]  rendered  Pointer to statistics of snd gathered while it was rendered, or NULL.
+ *                        Only needed for normalisation, which otherwise has to measure the peak
+ *                        in a separate pass.
+ *  \param[out] written   Pointer to receive statistics of the written samples, or NULL.
+ *
+ *  \return Empty string on success, description of the error otherwise.
+ */
+char *sound_save_as(const sound *snd, const char *filename, const sound_format *format,
+                    const sound_stats *rendered, sound_stats *written);
+
 /** \brief Play a sound to the default audio output device.
  *
  *  \deprecated While this was part of the initial planned functionality, it turns out to be hard to
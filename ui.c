@@ -81,6 +81,12 @@ void ui_init() {
 }
 
 static const int GRAPH_HEIGHT = 23;
+static const int GRAPH_WIDTH = 75;
+
+// map the index of a frequency out of n to the graph column it is drawn on
+static int _ui_column(int idx, int n) {
+    return (int) floor(idx * (GRAPH_WIDTH - 1.0) / (n - 1) + 0.5);
+}
 
 void ui_clear_curves() {
     _ui_write(BBLACK FDGRAY);
@@ -90,13 +96,14 @@ void ui_clear_curves() {
     }
 }
 
-void ui_curve(const double curve[NFREQ], const char *color) {
+void ui_curve(const double *curve, int n, const char *color) {
     _ui_write(BBLACK); _ui_write(color);
-    for(int i = 0; i < NFREQ; i++) {
+    for(int col = 0; col < GRAPH_WIDTH; col++) {
+        const int i = (int) floor(col * (n - 1.0) / (GRAPH_WIDTH - 1) + 0.5);
         const int level = (int)floor((curve[i] - LOGAIN) * (GRAPH_HEIGHT*3-1) / (HIGAIN - LOGAIN));
         if(level < 0 || level > GRAPH_HEIGHT*3-1) continue;
 
-        const int x = i + 2,
+        const int x = col + 2,
                   y = GRAPH_HEIGHT - level / 3,
                   suby = (level + 300) % 3;
 
@@ -139,10 +146,12 @@ void ui_scale() {
 }
 
 void ui_cursor(const equalizer *eq, int cursor_pos, double overall_db) {
+    const int cursor_x = _ui_column(cursor_pos, eq->nfreq) + 2;
+
     // draw vertical cursor axis
     _ui_write(BBLACK FGRAY);
     for(int y = 1; y <= GRAPH_HEIGHT; y++) {
-        _ui_gotoxy(cursor_pos + 2, y);
+        _ui_gotoxy(cursor_x, y);
         _ui_write("│");
     }
 
@@ -153,7 +162,7 @@ void ui_cursor(const equalizer *eq, int cursor_pos, double overall_db) {
             (int) round(eq->gain_db[cursor_pos]),
             eq_q_values[eq->q_idx[cursor_pos]],
             (int) round(overall_db));
-    int startx = cursor_pos + 2 - strlen(info) / 2;
+    int startx = cursor_x - strlen(info) / 2;
     if(startx < 1) startx = 1;
     if(startx + strlen(info) > 80) startx = 81 - strlen(info);
     _ui_gotoxy(startx, 23);
@@ -172,8 +181,8 @@ void ui_reset() {
 
 void ui_options() {
     _ui_write(BWHITE FDGRAY);
-    _ui_gotoxy(1, 24); _ui_write("[O] Open       [S] Save/Play  [Q] Quit       ");
-    _ui_gotoxy(1, 25); _ui_write("[↔] Frequency  [↕] Gain       [0-9] Q factor ");
+    _ui_gotoxy(1, 24); _ui_write("[O] Open       [S] Save/Play  [A] Auto-EQ    ");
+    _ui_gotoxy(1, 25); _ui_write("[↔] Freq [↕] Gain  [0-9] Q factor  [Q] Quit  ");
 }
 
 void ui_status(const char *line1, const char *line2) {
@@ -71,11 +71,14 @@ void ui_clean();
 void ui_clear_curves();
 
 /** \brief Draws a frequency response curve.
+ *
+ *  The curve is stretched or squeezed to fill the 75 columns of the graph, whatever its length.
  *
  *  \param[in] curve  Array of doubles in [LOGAIN; HIGAIN] to be drawn.
+ *  \param[in] n      Length of curve. [MINNFREQ; MAXNFREQ]
  *  \param[in] color  String of some terminal escape sequences to be run before drawing the curve.
  */
-void ui_curve(const double curve[NFREQ], const char *color);
+void ui_curve(const double *curve, int n, const char *color);
 
 /** \brief Draws the curve scale, with values in [LOGAIN; HIGAIN] */
 void ui_scale();